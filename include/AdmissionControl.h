@@ -0,0 +1,53 @@
+#ifndef ADMISSIONCONTROL_H
+#define ADMISSIONCONTROL_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <cstddef>
+
+/******************************************************************************************
+ * AdmissionControl - process wide connection limits checked when a client is accepted
+ *
+ *  	   Every event loop asks the same instance, so the limits hold across shards even
+ *  	   though SO_REUSEPORT spreads one address's connections over all of them. With only
+ *  	   a global limit an admit is one atomic add; the per-address counts sit behind a
+ *  	   mutex, which is only taken on accept and close, never per command.
+ *
+ *  	   instance - the store shared by every event loop
+ *  	   setLimits - total clients and clients per source address, 0 for unlimited. Set
+ *                     before the loops start
+ *  	   admit - counts a new client in and returns true, or returns false (counting
+ *                 nothing) if it would exceed a limit
+ *  	   release - counts an admitted client out again
+ *
+ *****************************************************************************************/
+
+class AdmissionControl
+{
+public:
+   static AdmissionControl &instance();
+
+   void setLimits(size_t maxClients, size_t maxPerAddress);
+   bool enabled() const { return (this->maxClients > 0) || (this->maxPerAddress > 0); };
+
+   bool admit(const std::string &address);
+   void release(const std::string &address);
+
+   size_t connected() const { return this->total.load(std::memory_order_relaxed); };
+
+private:
+   AdmissionControl();
+
+   size_t maxClients = 0;
+   size_t maxPerAddress = 0;
+
+   std::atomic<size_t> total{0};
+
+   //open clients per source address, entries are dropped when they reach zero
+   std::unordered_map<std::string, size_t> perAddress;
+   std::mutex perAddressLock;
+};
+
+#endif
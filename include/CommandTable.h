@@ -0,0 +1,87 @@
+#ifndef COMMANDTABLE_H
+#define COMMANDTABLE_H
+
+#include <array>
+#include <cstddef>
+#include <stdint.h>
+#include <string_view>
+
+/******************************************************************************************
+ * CommandTable - command name -> handler map that is built entirely at compile time
+ *
+ *  	   The entries are hashed (FNV-1a) into an open-addressed table at least twice the
+ *  	   size of the entry list, so a lookup is one hash of the command token, usually one
+ *  	   probe and one string compare, independent of how many commands are registered.
+ *  	   Declaring the table constexpr makes the compiler do all of the placement, and a
+ *  	   duplicate name fails the build through isValid().
+ *
+ *  	   find - returns the entry registered for name, or nullptr. Its id is the entry's
+ *  	          position in the list the table was built from
+ *  	   isValid - false if two entries share a name (use in a static_assert)
+ *
+ *****************************************************************************************/
+
+template <class Handler>
+struct CommandEntry
+{
+   std::string_view name;
+   Handler handler = nullptr;
+   //false means the command must be sent on its own, "hello x" is then an unknown command
+   bool acceptsArgs = false;
+   //position in the registration list, filled in by CommandTable (used to index per-command metrics)
+   unsigned short id = 0;
+};
+
+//FNV-1a, usable both at compile time and in the hot path
+constexpr uint32_t commandHash(std::string_view str) {
+   uint32_t hash = 2166136261u;
+   for (char c : str) {
+      hash ^= static_cast<unsigned char>(c);
+      hash *= 16777619u;
+   }
+   return hash;
+}
+
+template <class Handler, size_t N>
+class CommandTable
+{
+public:
+   //smallest power of two that keeps the load factor at or under one half
+   static constexpr size_t slotCount() {
+      size_t slots = 8;
+      while (slots < 2 * N)
+         slots *= 2;
+      return slots;
+   }
+
+   constexpr CommandTable(const std::array<CommandEntry<Handler>, N> &entries):slots{} {
+      for (size_t i = 0; i < N; i++) {
+         size_t index = commandHash(entries[i].name) & (slotCount() - 1);
+         while (this->slots[index].handler != nullptr) {
+            if (this->slots[index].name == entries[i].name)
+               this->duplicate = true;
+            index = (index + 1) & (slotCount() - 1);
+         }
+         this->slots[index] = entries[i];
+         this->slots[index].id = static_cast<unsigned short>(i);
+      }
+   }
+
+   constexpr const CommandEntry<Handler> *find(std::string_view name) const {
+      size_t index = commandHash(name) & (slotCount() - 1);
+      while (this->slots[index].handler != nullptr) {
+         if (this->slots[index].name == name)
+            return &this->slots[index];
+         index = (index + 1) & (slotCount() - 1);
+      }
+      return nullptr;
+   }
+
+   constexpr bool isValid() const { return !this->duplicate; };
+
+private:
+   std::array<CommandEntry<Handler>, slotCount()> slots;
+   bool duplicate = false;
+};
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef CONNTABLE_H
+#define CONNTABLE_H
+
+#include <vector>
+#include <cstddef>
+
+/******************************************************************************************
+ * ConnTable - growable connection table indexed directly by file descriptor
+ *
+ *  	   Connection objects are stored by value in one contiguous slab. A second array maps
+ *  	   an fd straight to its slab slot, so insert, find and remove are all O(1) with no
+ *  	   pointer chasing. Slots released by remove() go on a free-list and are handed out
+ *  	   again before the slab grows, which keeps live connections packed together.
+ *
+ *  	   insert - claims a slot for fd and returns it (a reset T), nullptr if fd is in use
+ *  	   find - returns the slot owning fd or nullptr
+ *  	   remove - resets the slot owning fd and puts it on the free-list
+ *  	   forEach - calls fn(fd, T&) for every live connection
+ *
+ *  	   Pointers returned by insert/find stay valid until the next insert, which may grow
+ *  	   the slab.
+ *
+ *****************************************************************************************/
+
+template <class T>
+class ConnTable
+{
+public:
+   ConnTable() {};
+   ~ConnTable() {};
+
+   T *insert(int fd) {
+      if (fd < 0)
+         return nullptr;
+      if (static_cast<size_t>(fd) >= this->fdToSlot.size())
+         this->fdToSlot.resize(fd + 1 + (fd >> 1), -1);
+      if (this->fdToSlot[fd] >= 0)
+         return nullptr;
+
+      int slot;
+      if (!this->freeSlots.empty()) {
+         slot = this->freeSlots.back();
+         this->freeSlots.pop_back();
+      } else {
+         slot = static_cast<int>(this->slots.size());
+         this->slots.emplace_back();
+         this->slotFD.push_back(-1);
+      }
+      this->fdToSlot[fd] = slot;
+      this->slotFD[slot] = fd;
+      this->liveCount++;
+      return &this->slots[slot];
+   }
+
+   T *find(int fd) {
+      if ((fd < 0) || (static_cast<size_t>(fd) >= this->fdToSlot.size()))
+         return nullptr;
+      int slot = this->fdToSlot[fd];
+      return (slot < 0) ? nullptr : &this->slots[slot];
+   }
+
+   void remove(int fd) {
+      if ((fd < 0) || (static_cast<size_t>(fd) >= this->fdToSlot.size()))
+         return;
+      int slot = this->fdToSlot[fd];
+      if (slot < 0)
+         return;
+      this->slots[slot] = T();
+      this->slotFD[slot] = -1;
+      this->fdToSlot[fd] = -1;
+      this->freeSlots.push_back(slot);
+      this->liveCount--;
+   }
+
+   template <class F>
+   void forEach(F fn) {
+      for (size_t slot = 0; slot < this->slots.size(); slot++) {
+         if (this->slotFD[slot] >= 0)
+            fn(this->slotFD[slot], this->slots[slot]);
+      }
+   }
+
+   // Reserves room for n connections up front so the slab does not grow under load
+   void reserve(size_t n) {
+      this->slots.reserve(n);
+      this->slotFD.reserve(n);
+      this->fdToSlot.reserve(n);
+   }
+
+   size_t size() const { return this->liveCount; };
+
+private:
+   // fd -> slot in slots, -1 when the fd is not in the table
+   std::vector<int> fdToSlot;
+
+   // the connection objects themselves, stored contiguously
+   std::vector<T> slots;
+
+   // slot -> fd, -1 when the slot is on the free-list
+   std::vector<int> slotFD;
+
+   std::vector<int> freeSlots;
+
+   size_t liveCount = 0;
+};
+
+#endif
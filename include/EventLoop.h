@@ -0,0 +1,43 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <sys/epoll.h>
+#include <vector>
+
+/******************************************************************************************
+ * EventLoop - thin wrapper around a Linux epoll instance used by the servers
+ *
+ *  	   EventLoop(Const): creates the epoll instance and sizes the ready-event array
+ *  	   ~EventLoop(Dest): closes the epoll instance
+ *
+ *  	   add/modify/remove - register, change or drop interest in a file descriptor. Each
+ *                           fd only has to be registered once for its whole lifetime
+ *  	   wait - blocks until at least one fd is ready (or timeoutMs passes, -1 for forever)
+ *                and returns the number of ready events, which are read with event()
+ *  	   
+ *  	   Exceptions: socket_error if the kernel refuses an epoll operation
+ *
+ *****************************************************************************************/
+
+class EventLoop
+{
+public:
+   EventLoop(int maxEvents = 1024);
+   ~EventLoop();
+
+   void add(int fd, uint32_t events);
+   void modify(int fd, uint32_t events);
+   void remove(int fd);
+
+   int wait(int timeoutMs);
+   const struct epoll_event &event(int i) const { return this->readyEvents[i]; }
+
+private:
+   //epoll instance file descriptor
+   int epoll_FD = -1;
+
+   //filled in by epoll_wait with the fds that are ready
+   std::vector<struct epoll_event> readyEvents;
+};
+
+#endif
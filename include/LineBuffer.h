@@ -0,0 +1,79 @@
+#ifndef LINEBUFFER_H
+#define LINEBUFFER_H
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+#include <stdint.h>
+
+/******************************************************************************************
+ * LineBuffer - per-connection input buffer with incremental newline framing
+ *
+ *  	   One contiguous block that the socket is read into directly: writePtr() hands out
+ *  	   free space at the tail, commit() marks how much the read filled. nextLine() returns
+ *  	   each complete line as a string_view into the block and remembers how far it has
+ *  	   scanned, so bytes are only ever searched for '\n' once no matter how many reads a
+ *  	   line takes to arrive. Consumed bytes are reclaimed by moving the (short) unread tail
+ *  	   to the front only when more room is needed.
+ *
+ *  	   writePtr - returns a pointer with at least minSpace free bytes behind it
+ *  	   writable - free bytes behind writePtr()
+ *  	   commit - marks n bytes after writePtr() as filled
+ *  	   append - copies data in, for engines that can not read into the buffer directly
+ *  	   nextLine - pops the next complete line (without its '\n'), false if there is none.
+ *                  The view is valid until the next writePtr/append/release call
+ *  	   pending - bytes received but not yet returned as a line
+ *  	   release - frees the block if nothing is pending, used to slim down idle connections.
+ *                 Given a block cache, a standard sized block goes back to it instead
+ *  	   attach - takes a block from the cache if the buffer has none
+ *
+ *  	   Positions are 32 bits, a connection never buffers anywhere near 4GB of input.
+ *
+ *****************************************************************************************/
+
+//standard sized read blocks released by idle connections, reused by the next one that reads
+class line_block_cache
+{
+public:
+   line_block_cache(size_t blockSize, size_t maxBlocks):blockSize(blockSize), maxBlocks(maxBlocks) {};
+
+   size_t blockSize;
+   size_t maxBlocks;
+   std::vector<std::unique_ptr<char[]>> blocks;
+};
+
+class LineBuffer
+{
+public:
+   LineBuffer();
+   ~LineBuffer();
+
+   LineBuffer(LineBuffer &&other) noexcept;
+   LineBuffer &operator=(LineBuffer &&other) noexcept;
+
+   char *writePtr(size_t minSpace);
+   size_t writable() const { return this->capacity - this->writePos; };
+   void commit(size_t n) { this->writePos += n; };
+   void append(const char *data, size_t n);
+
+   bool nextLine(std::string_view &line);
+
+   size_t pending() const { return this->writePos - this->readPos; };
+   size_t allocated() const { return this->capacity; };
+   void clear();
+   void release();
+   void release(line_block_cache &cache);
+   void attach(line_block_cache &cache);
+
+private:
+   std::unique_ptr<char[]> storage;
+   uint32_t capacity = 0;
+
+   //start of unconsumed data, end of data, and how far nextLine has already looked
+   uint32_t readPos = 0;
+   uint32_t writePos = 0;
+   uint32_t scanPos = 0;
+};
+
+#endif
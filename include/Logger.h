@@ -0,0 +1,112 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include "config.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+/******************************************************************************************
+ * Logger - asynchronous server log, nothing on the event loop path touches a stream or file
+ *
+ *  	   Each thread that logs gets its own fixed size ring of records, written only by
+ *  	   that thread and read only by the flusher thread, so a log call is a level check,
+ *  	   an snprintf into the next free slot and one release store. The flusher wakes every
+ *  	   few milliseconds, formats the timestamps and writes everything it found with one
+ *  	   write() call. A full ring drops the message (and counts it) instead of blocking.
+ *
+ *  	   instance - the process wide logger
+ *  	   start - opens the output (a file, or stderr if path is empty) and starts the
+ *                 flusher. Messages logged before start are kept until it runs
+ *  	   stop - drains every ring and joins the flusher
+ *  	   setLevel/enabled - runtime minimum level
+ *  	   log - printf style record, normally called through the LOG_* macros
+ *
+ *  	   LOG_DEBUG calls are compiled out unless configure was run with --enable-debug-log,
+ *  	   their arguments are still type checked but never evaluated.
+ *
+ *  	   Exceptions: start throws runtime_error if the log file can not be opened
+ *
+ *****************************************************************************************/
+
+enum LogLevel { LOG_LEVEL_DEBUG, LOG_LEVEL_INFO, LOG_LEVEL_WARN, LOG_LEVEL_ERROR };
+
+//text kept per record, longer messages are truncated
+#define LOG_RECORD_SIZE 256
+#define LOG_RING_RECORDS 1024
+
+class LogRecord
+{
+public:
+   int64_t timeUs;
+   uint16_t length;
+   uint8_t level;
+   char text[LOG_RECORD_SIZE - sizeof(int64_t) - sizeof(uint16_t) - sizeof(uint8_t) - 5];
+};
+
+//single producer (the owning thread), single consumer (the flusher)
+class LogRing
+{
+public:
+   LogRecord records[LOG_RING_RECORDS];
+
+   //next record the flusher reads, and next the owner writes, on separate cache lines
+   alignas(64) std::atomic<uint32_t> head{0};
+   alignas(64) std::atomic<uint32_t> tail{0};
+   std::atomic<uint64_t> dropped{0};
+};
+
+class Logger
+{
+public:
+   static Logger &instance();
+
+   void start(const std::string &path);
+   void stop();
+
+   void setLevel(LogLevel level) { this->minLevel.store(level, std::memory_order_relaxed); };
+   bool enabled(LogLevel level) const { return level >= this->minLevel.load(std::memory_order_relaxed); };
+
+   void log(LogLevel level, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+   static LogLevel parseLevel(const std::string &name, LogLevel fallback);
+
+private:
+   Logger();
+   ~Logger();
+
+   LogRing *threadRing();
+   void flushLoop();
+   bool drain(std::string &batch);
+   void writeBatch(const std::string &batch);
+
+   std::atomic<int> minLevel{LOG_LEVEL_INFO};
+
+   //every ring ever handed out, rings outlive their threads so nothing logged is lost
+   std::mutex ringsLock;
+   std::vector<std::unique_ptr<LogRing>> rings;
+
+   int outputFD = 2;
+   bool ownsOutput = false;
+   std::atomic<bool> running{false};
+   std::thread flusher;
+};
+
+#define LOG_AT(level, ...) \
+   do { if (Logger::instance().enabled(level)) Logger::instance().log(level, __VA_ARGS__); } while (0)
+
+#ifdef ENABLE_DEBUG_LOG
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do { if (false) Logger::instance().log(LOG_LEVEL_DEBUG, __VA_ARGS__); } while (0)
+#endif
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+/******************************************************************************************
+ * Metrics - server counters and per-command latency histograms
+ *
+ *  	   Every event loop records into its own MetricsShard, which only that loop writes,
+ *  	   so recording is a relaxed load and store on a private cache line: no locks and no
+ *  	   locked instructions. Readers merge all shards when a report is asked for, which
+ *  	   is the only time the shards are walked.
+ *
+ *  	   Latencies go into log-linear (HDR style) histograms: 16 linear sub-buckets per
+ *  	   power of two, so any percentile is within about 6% of the true value from 1ns up
+ *  	   to about 35 minutes.
+ *
+ *  	   instance - the process wide registry
+ *  	   newShard - a shard for one event loop, owned by the registry and never freed so
+ *                    totals survive the loop
+ *  	   nameCommand - label used for a command id in reports
+ *  	   collect - merged snapshot of every shard
+ *  	   report - the snapshot as the text sent for the stats command
+ *  	   startAdmin/stopAdmin - optional listener that answers every connection with the
+ *                              report and closes it, served by its own thread
+ *  	   openSegment/closeSegment - shared memory segment (see StatsSegment.h) that every
+ *                                  shard created afterwards publishes into
+ *
+ *  	   Exceptions: startAdmin throws socket_error if the listener can not be created,
+ *  	               openSegment throws runtime_error if the segment can not be mapped
+ *
+ *****************************************************************************************/
+
+//commands tracked individually, the last id is where unknown commands are counted
+#define METRIC_MAX_COMMANDS 32
+
+//histogram shape: 2^METRIC_SUB_BITS buckets per power of two, values capped at 2^METRIC_MAX_BITS ns
+#define METRIC_SUB_BITS 4
+#define METRIC_MAX_BITS 41
+#define METRIC_BUCKETS ((METRIC_MAX_BITS - METRIC_SUB_BITS + 1) << METRIC_SUB_BITS)
+
+class stats_loop_block;
+class stats_segment;
+
+enum MetricCounter { MET_ACCEPTED, MET_CLOSED, MET_BYTES_IN, MET_BYTES_OUT, MET_COMMANDS, MET_READ_PAUSES, MET_TIMEOUTS, MET_REJECTED, MET_THROTTLED, MET_COUNTER_COUNT };
+
+//single writer histogram, see Metrics
+class LatencyHistogram
+{
+public:
+   void record(uint64_t ns);
+
+   static unsigned int bucketFor(uint64_t ns);
+   static uint64_t bucketLow(unsigned int bucket);
+
+   std::atomic<uint64_t> count{0};
+   std::atomic<uint64_t> totalNs{0};
+   std::atomic<uint64_t> maxNs{0};
+   std::atomic<uint64_t> buckets[METRIC_BUCKETS] = {};
+};
+
+class MetricsShard
+{
+public:
+   //only the owning loop calls these, so a plain load and store is enough
+   void add(MetricCounter counter, uint64_t n) {
+      std::atomic<uint64_t> &value = this->counters[counter];
+      value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+   };
+   void recordCommand(unsigned int id, uint64_t ns);
+   void publish(uint64_t connections, uint64_t pausedClients, uint64_t pendingWrites);
+
+   alignas(64) std::atomic<uint64_t> counters[MET_COUNTER_COUNT] = {};
+   LatencyHistogram commands[METRIC_MAX_COMMANDS];
+
+   //this shard's block in the shared stats segment, nullptr when none is open
+   stats_loop_block *published = nullptr;
+};
+
+//merged view of every shard, plain numbers
+class MetricsSnapshot
+{
+public:
+   uint64_t percentileNs(unsigned int id, double fraction) const;
+
+   uint64_t counters[MET_COUNTER_COUNT] = {};
+   uint64_t commandCount[METRIC_MAX_COMMANDS] = {};
+   uint64_t commandTotalNs[METRIC_MAX_COMMANDS] = {};
+   uint64_t commandMaxNs[METRIC_MAX_COMMANDS] = {};
+   std::vector<uint64_t> buckets;
+   double uptimeSecs = 0;
+};
+
+class Metrics
+{
+public:
+   static Metrics &instance();
+
+   MetricsShard *newShard();
+   void nameCommand(unsigned int id, std::string_view name);
+
+   MetricsSnapshot collect();
+   std::string report();
+
+   void startAdmin(const std::string &ip, unsigned short port);
+   void stopAdmin();
+
+   void openSegment(const std::string &name);
+   void closeSegment();
+
+private:
+   Metrics();
+   ~Metrics();
+
+   void adminLoop();
+
+   std::mutex shardsLock;
+   std::vector<std::unique_ptr<MetricsShard>> shards;
+   std::string_view commandNames[METRIC_MAX_COMMANDS];
+   int64_t startedMs = 0;
+
+   int admin_FD = -1;
+   std::atomic<bool> adminRunning{false};
+   std::thread adminThread;
+
+   stats_segment *segment = nullptr;
+   std::string segmentName;
+};
+
+#endif
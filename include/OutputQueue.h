@@ -0,0 +1,72 @@
+#ifndef OUTPUTQUEUE_H
+#define OUTPUTQUEUE_H
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "ResponseStore.h"
+
+//most slices one write can carry, IOV_MAX on Linux
+#define OUTPUT_MAX_IOV 1024
+
+//slice capacity a drained queue keeps for its next replies, more than this is freed
+#define OUTPUT_KEPT_SLICES 16
+
+/******************************************************************************************
+ * OutputQueue - per-connection chain of reply slices waiting to be written
+ *
+ *  	   Each slice references an immutable Payload plus how much of it has already been
+ *  	   sent, so pre-built replies are queued without copying and a partial write just
+ *  	   moves an offset. Nothing is allocated before the first reply, and a drained queue
+ *  	   keeps room for at most OUTPUT_KEPT_SLICES slices, so a connection that once had a
+ *  	   large backlog does not hold on to it while idle.
+ *
+ *  	   push - queues a shared Payload (optionally leaving off its last trim bytes), or
+ *               copies text into a new one
+ *  	   bytes/empty - how much is still waiting
+ *  	   gather - fills an iovec array from the front of the queue (and optionally takes
+ *                  a reference on each Payload used, for writes that finish later)
+ *  	   consume - drops n written bytes from the front
+ *  	   writeTo - non-blocking sendmsg until the queue is empty or the socket is full.
+ *                   Returns bytes written, or -1 if the connection is broken
+ *
+ *****************************************************************************************/
+
+class OutputSlice
+{
+public:
+   Payload data;
+   size_t offset = 0;
+   //one past the last byte to send, less than data->size() when the tail was trimmed
+   size_t end = 0;
+};
+
+class OutputQueue
+{
+public:
+   OutputQueue();
+   ~OutputQueue();
+
+   void push(const Payload &payload, size_t trim = 0);
+   void push(std::string_view text);
+
+   size_t bytes() const { return this->pendingBytes; };
+   bool empty() const { return this->pendingBytes == 0; };
+
+   int gather(struct iovec *iov, int maxIov, std::vector<Payload> *hold = nullptr) const;
+   void consume(size_t n);
+   ssize_t writeTo(int fd);
+   void clear();
+
+private:
+   std::vector<OutputSlice> slices;
+
+   //first slice not yet fully written
+   size_t head = 0;
+   size_t pendingBytes = 0;
+};
+
+#endif
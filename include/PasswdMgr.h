@@ -0,0 +1,143 @@
+#ifndef PASSWDMGR_H
+#define PASSWDMGR_H
+
+#include <string>
+#include <vector>
+#include <shared_mutex>
+#include <mutex>
+#include <cstddef>
+#include <stdint.h>
+#include <sys/types.h>
+
+/******************************************************************************************
+ * PasswdMgr - password store kept in a memory-mapped, append-only file with an in-memory
+ *             open-addressing index over it
+ *
+ *  	   The file is a header followed by fixed size records, one per add or password
+ *  	   change, each holding the user name, salt, hash and the parameters it was hashed
+ *  	   with. The newest record of a name wins. Opening maps the file and scans it once;
+ *  	   after that a lookup is one probe sequence in the index and a name compare in the
+ *  	   mapping, no read calls. A change appends one record and syncs it, the rest of the
+ *  	   file is never rewritten until superseded records outnumber live ones, at which
+ *  	   point the live ones are compacted into a fresh file renamed over the old.
+ *
+ *  	   Records carry a checksum, so a record torn by a crash mid-append is ignored and
+ *  	   cut off by the next write. Writers hold an flock on the file, which also lets
+ *  	   my_adduser change a store the server has open: the server catches up (or reopens
+ *  	   after a compaction) before every write and whenever a name is not found.
+ *
+ *  	   Hashes use Argon2id when libargon2 was found by configure, PBKDF2-HMAC-SHA256 from
+ *  	   libcrypto otherwise; the algorithm is stored per record, so a store written by one
+ *  	   build can be checked by another that has it.
+ *
+ *  	   checkUser - true if the name has a record
+ *  	   knownUser - true if the name is in the index as last loaded, never touches the file
+ *  	               or waits for a writer, so a miss may still be a user another process added
+ *  	   checkPasswd - true if the password matches the name's newest hash
+ *  	   changePasswd - appends a new hash for an existing user, false if there is none
+ *  	   addUser - appends a first record for a new user, false if the name is taken
+ *  	   compact - rewrites the file with only the live records
+ *  	   validName - whether addUser would take the name
+ *
+ *  	   All members are safe to call from several threads at once.
+ *
+ *  	   Exceptions: runtime_error if the file can not be opened, mapped or written or is not
+ *  	   a password store, invalid_argument if a name given to addUser is empty, too long or
+ *  	   has spaces or control characters in it
+ *
+ *****************************************************************************************/
+
+//hashing schemes a record can have been written with
+enum PasswdAlgorithm { PWD_ALG_NONE = 0, PWD_ALG_ARGON2ID = 1, PWD_ALG_PBKDF2_SHA256 = 2 };
+
+#define PASSWD_MAX_NAME 48
+#define PASSWD_SALT_LEN 16
+#define PASSWD_HASH_LEN 32
+
+//one add or change, exactly as stored in the file
+struct passwd_record
+{
+   //FNV-1a over everything after it, 0 never matches so zeroed space is not a record
+   uint32_t checksum;
+   uint8_t algorithm;
+   uint8_t nameLen;
+   uint8_t reserved[2];
+   //iterations for PBKDF2, passes for Argon2, and Argon2's memory in KiB
+   uint32_t cost;
+   uint32_t memoryKiB;
+   char name[PASSWD_MAX_NAME];
+   uint8_t salt[PASSWD_SALT_LEN];
+   uint8_t hash[PASSWD_HASH_LEN];
+   uint8_t pad[16];
+};
+
+static_assert(sizeof(passwd_record) == 128, "passwd_record must stay 128 bytes, it is the on-disk format");
+
+class PasswdMgr
+{
+public:
+   PasswdMgr(const char *pwd_file);
+   ~PasswdMgr();
+
+   bool checkUser(const char *name);
+   bool knownUser(const char *name);
+   bool checkPasswd(const char *name, const char *passwd);
+   bool changePasswd(const char *name, const char *newpassword);
+   bool addUser(const char *name, const char *passwd);
+   void compact();
+
+   size_t users();
+   size_t superseded();
+
+   // algorithm new records are written with in this build
+   static PasswdAlgorithm defaultAlgorithm();
+   // 1 to PASSWD_MAX_NAME printable characters, no spaces
+   static bool validName(const char *name, size_t nameLen);
+
+private:
+   //index entry: name hash and record number + 1, 0 marks an empty slot
+   struct index_slot
+   {
+      uint32_t hash;
+      uint32_t record;
+   };
+
+   void openFile();
+   void closeFile();
+   void mapTo(size_t bytes);
+   void scanFrom(size_t record);
+   void refresh();
+   void reopen();
+   void lockForWrite();
+   void rewrite();
+   bool appendRecord(const char *name, const char *passwd, bool mustExist);
+
+   const passwd_record *find(const char *name, size_t nameLen) const;
+   void indexRecord(uint32_t record);
+   void growIndex();
+
+   static void hashPassword(const passwd_record &params, const char *passwd, uint8_t *hash);
+
+   std::string path;
+   int fd = -1;
+
+   //mapping of the file, records start after the header
+   char *base = nullptr;
+   size_t mappedBytes = 0;
+   //valid records in the mapping, bytes after them are a torn append
+   size_t recordCount = 0;
+   //inode and size this process last saw, to notice another writer
+   ino_t inode = 0;
+   off_t fileBytes = 0;
+
+   std::vector<index_slot> index;
+   size_t live = 0;
+
+   //readers share lock, which is only held exclusively while the mapping or index changes.
+   //writeLock serializes this process's writers (and refresh), which own fd, inode and
+   //fileBytes, so the flock wait and the syncs happen without blocking lookups
+   std::shared_mutex lock;
+   std::mutex writeLock;
+};
+
+#endif
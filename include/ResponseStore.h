@@ -0,0 +1,77 @@
+#ifndef RESPONSESTORE_H
+#define RESPONSESTORE_H
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <stdint.h>
+
+/******************************************************************************************
+ * ResponseStore - pre-serialized replies for the commands whose answer never changes
+ *
+ *  	   Each reply is built once, prompt included, into an immutable reference counted
+ *  	   buffer (Payload). Engines queue the Payload itself, so answering hello or menu
+ *  	   allocates and copies nothing. A complete set of replies is published as one
+ *  	   immutable ResponseSet; loading a file builds a new set and swaps it in, and
+ *  	   anything still queued keeps the old buffers alive through its reference.
+ *
+ *  	   instance - the process wide store shared by every event loop
+ *  	   snapshot/version - the current set and a counter bumped on every swap, so a loop
+ *                            only has to re-fetch its snapshot when the version changed
+ *  	   loadFile - replaces the replies from a file, remembered for reload()
+ *  	   reload - re-reads the last file, keeps the current set if that fails
+ *  	   requestReload/takeReloadRequest - async-signal-safe hand off from a SIGHUP handler
+ *
+ *  	   File format: "[name]" starts a section, the following lines up to the next section
+ *  	   are its text. Lines starting with '#' are comments. Sections: greeting, menu,
+ *  	   hello, passwd, graphic3, graphic4, graphic5. Missing sections keep their default.
+ *
+ *  	   Exceptions: loadFile throws runtime_error if the file can not be read
+ *
+ *****************************************************************************************/
+
+typedef std::shared_ptr<const std::string> Payload;
+
+//RESP_PROMPT is the bare prompt every other reply ends with, sent alone when prompts are batched
+enum ResponseID { RESP_WELCOME, RESP_MENU, RESP_HELLO, RESP_PASSWD, RESP_GRAPHIC1, RESP_GRAPHIC2, RESP_GRAPHIC3, RESP_PROMPT, RESP_COUNT };
+
+class ResponseSet
+{
+public:
+   const Payload &get(ResponseID id) const { return this->payloads[id]; };
+
+   std::array<Payload, RESP_COUNT> payloads;
+};
+
+class ResponseStore
+{
+public:
+   static ResponseStore &instance();
+
+   std::shared_ptr<const ResponseSet> snapshot() const;
+   uint64_t version() const { return this->currentVersion.load(std::memory_order_acquire); };
+
+   void loadFile(const std::string &path);
+   bool reload();
+
+   static void requestReload();
+   bool takeReloadRequest();
+
+private:
+   ResponseStore();
+
+   void publish(std::shared_ptr<const ResponseSet> replies);
+
+   std::shared_ptr<const ResponseSet> current;
+   std::atomic<uint64_t> currentVersion{0};
+
+   //file given to loadFile, reload() reads it again
+   std::string sourcePath;
+   std::mutex loadLock;
+
+   static std::atomic<bool> reloadRequested;
+};
+
+#endif
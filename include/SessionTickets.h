@@ -0,0 +1,87 @@
+#ifndef SESSIONTICKETS_H
+#define SESSIONTICKETS_H
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <cstddef>
+#include <stdint.h>
+
+/******************************************************************************************
+ * SessionTickets - process wide store of short-lived tickets that let a client that just
+ *                  logged in log in again without its password being hashed
+ *
+ *  	   A ticket is a number and an HMAC-SHA256 tag over it, keyed with random bytes drawn
+ *  	   when tickets are enabled, written as hex. Redeeming one checks the tag first, so a
+ *  	   made-up ticket is turned away without the lock being taken, then looks the number
+ *  	   up among the most recently issued tickets. Only that bounded list is kept: the
+ *  	   oldest ticket is dropped when it is full, and a ticket is gone once redeemed, the
+ *  	   client is given a new one each time it logs in.
+ *
+ *  	   Every user has a generation that a password change moves on; a ticket is only good
+ *  	   for the generation it was issued in. Changes made with my_adduser are not seen
+ *  	   here, the tickets issued before them last until they expire.
+ *
+ *  	   instance - the store shared by every event loop
+ *  	   enable - tickets last lifetimeSecs, at most capacity are kept. Call before the loops
+ *                  start, without it issue returns nothing and redeem always fails
+ *  	   issue - a new ticket for user, valid until nowMs + the lifetime
+ *  	   redeem - the user the ticket was issued to, if it is genuine, known, unexpired and
+ *                  the user's password has not changed since; the ticket is used up
+ *  	   revoke - makes every ticket issued to user so far useless
+ *
+ *  	   Times are CLOCK_MONOTONIC milliseconds, tickets do not outlive the process.
+ *
+ *  	   Exceptions: runtime_error from enable if this build has no libcrypto or no random
+ *                     bytes could be had for the key
+ *
+ *****************************************************************************************/
+
+#define TICKET_KEY_LEN 32
+#define TICKET_TAG_LEN 16
+//hex text of the ticket number and its tag
+#define TICKET_TEXT_LEN (2 * (8 + TICKET_TAG_LEN))
+
+class SessionTickets
+{
+public:
+   static SessionTickets &instance();
+
+   void enable(unsigned int lifetimeSecs, size_t capacity);
+   bool enabled() const { return this->lifetimeMs > 0; };
+
+   std::string issue(std::string_view user, int64_t nowMs);
+   bool redeem(std::string_view ticket, int64_t nowMs, std::string &user);
+   void revoke(std::string_view user);
+
+private:
+   SessionTickets();
+
+   //a ticket that has been issued and not yet redeemed or dropped
+   struct ticket_entry
+   {
+      uint64_t number;
+      int64_t expiresMs;
+      uint32_t generation;
+      std::string user;
+   };
+
+   void sign(uint64_t number, uint8_t *tag) const;
+   uint32_t generationOf(const std::string &user) const;
+
+   int64_t lifetimeMs = 0;
+   size_t capacity = 0;
+   uint8_t key[TICKET_KEY_LEN];
+
+   //newest first, the last entry is the one dropped when the list is full
+   std::list<ticket_entry> recent;
+   std::unordered_map<uint64_t, std::list<ticket_entry>::iterator> byNumber;
+   //users whose password changed while the server ran, the rest are at generation 0
+   std::unordered_map<std::string, uint32_t> generations;
+   uint64_t nextNumber = 1;
+   std::mutex ticketLock;
+};
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef STATSSEGMENT_H
+#define STATSSEGMENT_H
+
+#include <atomic>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Metrics.h"
+
+/******************************************************************************************
+ * StatsSegment - layout of the shared memory segment tcpserver publishes its counters in
+ *
+ *  	   The segment is created with shm_open under "/tcpserver-<port>" and read by
+ *  	   tcpserver-stat, which maps it read-only and never talks to the server. Every event
+ *  	   loop owns one stats_loop_block and republishes its counters into it at the end of
+ *  	   each loop pass under a seqlock: the sequence is odd while an update is in progress,
+ *  	   and a reader retries whenever it saw an odd value or the value changed during its
+ *  	   copy. The writer never waits for readers. A reader gives up after
+ *  	   STATS_READ_RETRIES tries, since a writer killed mid-update leaves the sequence odd
+ *  	   for good; writerAlive then tells a dead server from a busy one. The server's
+ *  	   process start time is stored next to its pid, so a crashed server's segment is not
+ *  	   taken for a live one once the pid is reused.
+ *
+ *  	   Fields are relaxed atomics so the concurrent copy is well defined, the fences in
+ *  	   beginWrite/endWrite and readLoopBlock provide the ordering.
+ *
+ *  	   Bump STATS_SEGMENT_VERSION whenever the layout changes.
+ *
+ *****************************************************************************************/
+
+#define STATS_SEGMENT_MAGIC 0x54435353u
+#define STATS_SEGMENT_VERSION 4
+#define STATS_MAX_LOOPS 256
+#define STATS_NAME_LENGTH 16
+#define STATS_READ_RETRIES 100000
+
+class stats_loop_block
+{
+public:
+   alignas(64) std::atomic<uint32_t> sequence{0};
+   std::atomic<uint64_t> counters[MET_COUNTER_COUNT];
+   std::atomic<uint64_t> commands[METRIC_MAX_COMMANDS];
+   //gauges: clients connected, reads paused by backpressure, clients with writes outstanding
+   std::atomic<uint64_t> connections;
+   std::atomic<uint64_t> pausedClients;
+   std::atomic<uint64_t> pendingWrites;
+
+   void beginWrite() {
+      this->sequence.store(this->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+   };
+   void endWrite() {
+      std::atomic_thread_fence(std::memory_order_release);
+      this->sequence.store(this->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+   };
+};
+
+class stats_segment
+{
+public:
+   uint32_t magic;
+   uint32_t version;
+   int32_t serverPID;
+   std::atomic<uint32_t> loopCount;
+   int64_t startedMs;
+   //start time of serverPID in clock ticks since boot, 0 if /proc was not readable
+   uint64_t serverStartTicks;
+   char commandNames[METRIC_MAX_COMMANDS][STATS_NAME_LENGTH];
+   stats_loop_block loops[STATS_MAX_LOOPS];
+};
+
+//plain copy of one loop block
+class stats_loop_values
+{
+public:
+   uint64_t counters[MET_COUNTER_COUNT] = {};
+   uint64_t commands[METRIC_MAX_COMMANDS] = {};
+   uint64_t connections = 0;
+   uint64_t pausedClients = 0;
+   uint64_t pendingWrites = 0;
+};
+
+//seqlock read side: copies a block, retrying until the copy did not overlap an update.
+//false if every try overlapped one, out is then not a consistent copy
+inline bool readLoopBlock(const stats_loop_block &block, stats_loop_values &out) {
+   for (int attempt = 0; attempt < STATS_READ_RETRIES; attempt++) {
+      uint32_t before = block.sequence.load(std::memory_order_acquire);
+      if (before & 1) {
+         sched_yield();
+         continue;
+      }
+      for (int c = 0; c < MET_COUNTER_COUNT; c++)
+         out.counters[c] = block.counters[c].load(std::memory_order_relaxed);
+      for (int i = 0; i < METRIC_MAX_COMMANDS; i++)
+         out.commands[i] = block.commands[i].load(std::memory_order_relaxed);
+      out.connections = block.connections.load(std::memory_order_relaxed);
+      out.pausedClients = block.pausedClients.load(std::memory_order_relaxed);
+      out.pendingWrites = block.pendingWrites.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (block.sequence.load(std::memory_order_relaxed) == before)
+         return true;
+   }
+   return false;
+}
+
+//start time of a process in clock ticks since boot (field 22 of /proc/<pid>/stat), 0 if unknown
+inline uint64_t processStartTicks(int pid) {
+   char path[32];
+   char line[1024];
+   snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+   FILE *file = fopen(path, "r");
+   if (file == NULL)
+      return 0;
+   size_t length = fread(line, 1, sizeof(line) - 1, file);
+   fclose(file);
+   line[length] = '\0';
+   // the command name in field 2 may hold spaces, fields are counted from its closing paren
+   char *field = strrchr(line, ')');
+   for (int i = 2; (field != NULL) && (i < 22); i++) {
+      field = strchr(field + 1, ' ');
+   }
+   return (field == NULL) ? 0 : strtoull(field + 1, NULL, 10);
+}
+
+//whether the server that created the segment is still running (EPERM: running as another user),
+//and is the same process rather than a later one given its pid
+inline bool writerAlive(const stats_segment &segment) {
+   if ((segment.serverPID <= 0) || ((kill(segment.serverPID, 0) < 0) && (errno != EPERM)))
+      return false;
+   uint64_t started = processStartTicks(segment.serverPID);
+   return (segment.serverStartTicks == 0) || (started == 0) || (started == segment.serverStartTicks);
+}
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef TCPBENCH_H
+#define TCPBENCH_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <stdint.h>
+
+#include "EventLoop.h"
+
+/******************************************************************************************
+ * TCPBench - load generator for tcpserver
+ *
+ *  	   Opens many connections, waits for each greeting and then drives a weighted mix of
+ *  	   commands over them. Replies are framed by counting COMMAND: prompts, so the server
+ *  	   must send one prompt per reply (do not run it with -B). Connections are spread over
+ *  	   worker threads, each with its own epoll loop and latency histogram.
+ *
+ *  	   Closed loop (rate 0): every connection keeps `pipeline` commands in flight and
+ *  	   sends the next one as soon as a reply arrives. Latency is measured from the send.
+ *
+ *  	   Fixed rate: every connection has a schedule of intended send times adding up to
+ *  	   the requested total rate. Latency is measured from the intended time, not the
+ *  	   actual send, so a stalled server is charged for the requests it held back
+ *  	   (coordinated omission correction). At most `pipeline` commands are in flight
+ *  	   per connection; late commands are sent as soon as there is room. Commands that
+ *  	   came due before the end but were never sent, and commands still unanswered
+ *  	   when the drain gives up, are counted as timeouts with their latency taken to
+ *  	   the end of the run, so they land in the percentiles instead of vanishing.
+ *
+ *  	   setMix - "cmd:weight,cmd:weight,...", e.g. "hello:4,1:1,menu:1,bogus:1"
+ *  	   run - connects, runs for the duration and collects the workers' results
+ *  	   printReport - throughput and latency percentiles
+ *
+ *  	   Exceptions: setMix throws invalid_argument on a malformed mix, run throws
+ *  	               socket_error if connections can not be established
+ *
+ *****************************************************************************************/
+
+//one load generating connection
+class bench_conn
+{
+public:
+   int fd = -1;
+   bool ready = false;
+   //how much of the prompt the last read ended in
+   unsigned int promptMatched = 0;
+   //send (closed loop) or intended send (fixed rate) time of each command in flight, oldest first
+   std::vector<int64_t> inflight;
+   size_t inflightHead = 0;
+   size_t inflightCount = 0;
+   //commands the socket did not take yet
+   std::string pendingOut;
+   //fixed rate: intended time of the next command
+   int64_t nextDueNs = 0;
+   size_t mixPos = 0;
+};
+
+class bench_worker
+{
+public:
+   std::vector<bench_conn> conns;
+   std::vector<int> fdToConn;
+   std::vector<uint64_t> histogram;
+   uint64_t completed = 0;
+   uint64_t sent = 0;
+   uint64_t errors = 0;
+   //never answered by the end of the drain, and due before the end but never sent
+   uint64_t timedOut = 0;
+   uint64_t unsent = 0;
+   uint64_t maxNs = 0;
+};
+
+class TCPBench
+{
+public:
+   TCPBench();
+   ~TCPBench();
+
+   void setTarget(const std::string &ip, unsigned short port);
+   void setConnections(unsigned int connections);
+   void setDuration(unsigned int seconds);
+   void setRate(uint64_t perSecond);
+   void setPipeline(unsigned int depth);
+   void setThreads(unsigned int threads);
+   void setMix(const std::string &spec);
+
+   void run();
+   void printReport();
+
+private:
+   void connectAll();
+   void runWorker(bench_worker &worker);
+   void sendDue(bench_worker &worker, bench_conn &conn, int64_t now);
+   bool readReplies(bench_worker &worker, bench_conn &conn, int64_t now);
+   void recordLatency(bench_worker &worker, uint64_t latency);
+   void recordUnanswered(bench_worker &worker, int64_t now);
+   uint64_t percentileNs(double fraction) const;
+
+   std::string ip = "127.0.0.1";
+   unsigned short port = 9999;
+   unsigned int connections = 100;
+   unsigned int durationSecs = 10;
+   uint64_t rate = 0;
+   unsigned int pipeline = 1;
+   unsigned int threadCount = 1;
+
+   //commands expanded by weight, each ending in a newline
+   std::vector<std::string> mix;
+
+   std::vector<bench_worker> workers;
+   int64_t startNs = 0;
+   int64_t endNs = 0;
+
+   //merged results
+   std::vector<uint64_t> histogram;
+   uint64_t completed = 0;
+   uint64_t sent = 0;
+   uint64_t errors = 0;
+   uint64_t timedOut = 0;
+   uint64_t unsent = 0;
+   uint64_t maxNs = 0;
+};
+
+#endif
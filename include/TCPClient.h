@@ -5,9 +5,9 @@
 #include "Client.h"
 #include <netinet/in.h>
 
-// The amount to read in before we send a packet
-const unsigned int stdin_bufsize = 50;
-const unsigned int socket_bufsize = 100;
+// The most read from stdin or the socket in one call
+const unsigned int stdin_bufsize = 4096;
+const unsigned int socket_bufsize = 65536;
 
 class TCPClient : public Client
 {
@@ -22,9 +22,32 @@ public:
 
    void errorCheck(int input, std::string errMess);
 
+   //batch mode: handleConnection sends the file's commands instead of reading stdin
+   void setBatch(const std::string &path, unsigned int repeat, unsigned int depth);
+
 private:
+   void runBatch();
+   size_t countPrompts(const char *data, size_t length);
+   bool readServer();
+   bool readInput();
+   void sendAll(const char *data, size_t length);
+
    int socketFD;
 
+   //typed bytes not yet ending in a newline
+   std::string inputPending;
+
+   //stdin reached EOF or the user sent exit, only the server's remaining output is wanted
+   bool inputDone = false;
+
+   //batch mode settings, an empty file name means interactive
+   std::string batchFile;
+   unsigned int batchRepeat = 1;
+   unsigned int batchDepth = 1;
+
+   //how much of the COMMAND: prompt the last read ended in
+   size_t promptMatched = 0;
+
    struct sockaddr_in servAddress;
 };
 
@@ -1,54 +1,123 @@
 #ifndef TCPCONN_H
 #define TCPCONN_H
 
-#include "FileDesc.h"
+#include "LineBuffer.h"
+#include "OutputQueue.h"
+#include "PasswdMgr.h"
+
+#include <sys/socket.h>
+#include <stdint.h>
+#include <string>
+#include <string_view>
 
 const int max_attempts = 2;
 
-class TCPConn 
+/******************************************************************************************
+ * TCPConn - one client session: its socket, buffers, login state and limits, driven by the
+ *           event loop that owns it
+ *
+ *  	   Stored by value in the loop's connection table and reset (not freed) when the
+ *  	   client leaves. The layout is fixed at four cache lines: the first holds what every
+ *  	   read touches (fd, flags, session state, idle clock, input buffer), the second the
+ *  	   output queue and rate limit, the rest the peer address and login details that are
+ *  	   only used on accept, login and the odd command. Nothing in here allocates once a
+ *  	   connection is set up: the input block is borrowed from the loop while data is
+ *  	   pending and handed back when it drains, so an idle session costs just this object.
+ *
+ *  	   The session starts at s_username when the server has a password file, at s_menu
+ *  	   otherwise. Complete input lines move it along:
+ *
+ *  	      s_username -> s_passwd -> s_menu (commands) -> s_changepwd -> s_confirmpwd -> s_menu
+ *
+ *  	   setPeer - formats the client's address once at accept
+ *  	   setUser - remembers the name given at s_username
+ *  	   keepNewPasswd/clearSecrets - hold the new password until it is confirmed, and wipe
+ *                                    it afterwards
+ *
+ *  	   Passwords handed to the worker pool travel in a shared secret_buffer rather than a
+ *  	   plain string copy, so the work wipes the one buffer once it has hashed it (and its
+ *  	   destructor does if the work never ran).
+ *
+ *****************************************************************************************/
+
+//plaintext password on its way to the worker pool, overwritten by wipe and on destruction
+class secret_buffer
 {
 public:
-   TCPConn();
-   ~TCPConn();
-
-   bool accept(SocketFD &server);
-
-   int sendText(const char *msg);
-   int sendText(const char *msg, int size);
+   explicit secret_buffer(std::string_view text):text(text) {};
+   ~secret_buffer() { wipe(); };
+   secret_buffer(const secret_buffer &) = delete;
+   secret_buffer &operator=(const secret_buffer &) = delete;
 
-   void handleConnection();
-   void startAuthentication();
-   void getUsername();
-   void getPasswd();
-   void sendMenu();
-   void getMenuChoice();
-   void setPassword();
-   void changePassword();
-   
-   bool getUserInput(std::string &cmd);
-
-   void disconnect();
-   bool isConnected();
-
-   unsigned long getIPAddr() { return _connfd.getIPAddr(); };
+   const char *c_str() const { return this->text.c_str(); };
+   void wipe();
 
 private:
+   std::string text;
+};
 
+class alignas(64) TCPConn
+{
+public:
+   enum statustype : uint8_t { s_username, s_changepwd, s_confirmpwd, s_passwd, s_menu };
 
-   enum statustype { s_username, s_changepwd, s_confirmpwd, s_passwd, s_menu };
-
-   statustype _status = s_username;
-
-   SocketFD _connfd;
- 
-   std::string _username; // The username this connection is associated with
-
-   std::string _inputbuf;
-
-   std::string _newpwd; // Used to store user input for changing passwords
-
-   int _pwd_attempts = 0;
+   TCPConn();
+   ~TCPConn();
+   TCPConn(TCPConn &&) = default;
+   TCPConn &operator=(TCPConn &&) = default;
+
+   void setPeer(const struct sockaddr *peer);
+   void setUser(std::string_view name);
+   std::string_view user() const { return std::string_view(this->username, this->usernameLen); };
+   void keepNewPasswd(std::string_view passwd) { this->newPasswd.assign(passwd.data(), passwd.size()); };
+   void clearSecrets();
+
+   // first cache line, touched by every read
+
+   int socketObjFD = 0;
+   statustype status = s_menu;
+   uint8_t pwdAttempts = 0;
+   //EPOLLOUT is only requested while output is pending
+   bool writeWatch = false;
+   //set while output is over the high-water mark (or while throttled or waiting on the worker
+   //pool), nothing more is read until it drains
+   bool readPaused = false;
+   //already listed in dirtyClients for the end of the loop pass
+   bool flushQueued = false;
+   //batched prompts only: replies were queued without their prompt, one is due before the write
+   bool promptOwed = false;
+   //over the command rate, reads resume at throttledUntilMs
+   bool throttled = false;
+   //a command is running on the worker pool, reads stay paused so no reply can overtake its one
+   bool awaitingWork = false;
+   //loop time of the last read, and since when an unfinished command has been waiting (0 = none)
+   int64_t lastReadMs = 0;
+   int64_t partialSinceMs = 0;
+   //bytes received from the client, complete lines are commands
+   LineBuffer input;
+   //tells this connection apart from a later one on the same fd when offloaded work returns
+   uint64_t serial = 0;
+
+   // second cache line, replies and rate limiting
+
+   //replies not yet accepted by the socket
+   OutputQueue output;
+   //command rate limit: tokens left, refilled from tokensAtMs on use
+   double tokens = 0;
+   int64_t tokensAtMs = 0;
+   int64_t throttledUntilMs = 0;
+
+   // cold, accept and login only
+
+   //peer address as given by accept, formatted once for commands 1 and 2 and the logs
+   std::string peerIP;
+   unsigned short peerPort = 0;
+   uint8_t usernameLen = 0;
+   char username[PASSWD_MAX_NAME];
+   //first entry of a password change, until it is confirmed
+   std::string newPasswd;
 };
 
+static_assert(sizeof(TCPConn) == 256, "TCPConn is meant to be exactly four cache lines");
 
 #endif
@@ -2,22 +2,42 @@
 #define TCPSERVER_H
 
 #include "Server.h"
+#include "EventLoop.h"
+#include "ConnTable.h"
+#include "LineBuffer.h"
+#include "TCPConn.h"
+#include "ResponseStore.h"
+#include "OutputQueue.h"
+#include "Metrics.h"
+#include "TimerWheel.h"
+#include "WorkerPool.h"
 
 #include <netinet/in.h>
+#include <sys/socket.h>
+#include <stdint.h>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <memory>
+#include <thread>
+#include <atomic>
+#include <functional>
 
-//client socket object helps keep commands and sockets together for cleaner code
-//this object is only used by TCPServer
-class socket_obj
+//how quickly one event loop absorbs new connections, reported at shutdown and once a second while accepting
+class accept_stats
 {
 public:
-   socket_obj();
-   ~socket_obj();      
-   int socketObjFD = 0;
-   std::string command = "";
-
+   uint64_t accepted = 0;
+   //wakeups that accepted at least one client, and the most taken in one of them
+   uint64_t batches = 0;
+   unsigned int largestBatch = 0;
+   //EMFILE/ENFILE left connections queued, ECONNABORTED dropped ones the client gave up on
+   uint64_t deferred = 0;
+   uint64_t aborted = 0;
+   //accepts in the current one second window and the busiest window so far
+   int64_t windowStartMs = 0;
+   uint64_t windowCount = 0;
+   uint64_t peakPerSecond = 0;
 };
 
 class TCPServer : public Server 
@@ -35,20 +55,182 @@ public:
    std::string getClientIP(const int inputFD);
    std::string getClientPort(const int inputFD);
 
-   void sendMessageToClient(int inputClientFD, std::string message);
-   void closeClient(int inputClientFD, int index);
+   virtual void sendMessageToClient(int inputClientFD, std::string_view message);
+   void sendReply(TCPConn &client, const Payload &payload);
+   void sendReply(TCPConn &client, std::string_view body);
+   virtual void closeClient(int inputClientFD);
    void printDisconnectedClientInfo(const int sd);
-   void checkForIntCommand(char *readCommand, int socket);
 
-private:
-   //stores server socket file descriptor
+   //every command handler has this shape, returning false when it closed the connection
+   typedef bool (TCPServer::*CommandHandler)(TCPConn &client, std::string_view args);
+   bool dispatchCommand(TCPConn &client, std::string_view readCommand);
+
+   void setThreads(unsigned int threads);
+   void setHighWater(size_t bytes);
+   void setBatchPrompt(bool enabled);
+   void setBacklog(int backlog);
+   void setDeferAccept(int seconds);
+   void setIdleTimeout(unsigned int seconds);
+   void setReadTimeout(unsigned int seconds);
+   void setCommandRate(unsigned int perSecond, unsigned int burst);
+   void setPasswords(std::shared_ptr<PasswdMgr> store);
+   const accept_stats &acceptStats() const { return this->acceptCounters; };
+   void requestStop();
+
+   void acceptClients();
+   void handleClient(int currentClientFD, uint32_t events);
+   bool processCommands(TCPConn &client);
+
+protected:
+   //command handlers, registered in the command table in TCPServer.cpp
+   friend struct CommandRegistry;
+   bool cmdHello(TCPConn &client, std::string_view args);
+   bool cmdExit(TCPConn &client, std::string_view args);
+   bool cmdPasswd(TCPConn &client, std::string_view args);
+   bool cmdMenu(TCPConn &client, std::string_view args);
+   bool cmdClientIP(TCPConn &client, std::string_view args);
+   bool cmdClientPort(TCPConn &client, std::string_view args);
+   bool cmdGraphic1(TCPConn &client, std::string_view args);
+   bool cmdGraphic2(TCPConn &client, std::string_view args);
+   bool cmdGraphic3(TCPConn &client, std::string_view args);
+   bool cmdStats(TCPConn &client, std::string_view args);
+   bool cmdResume(TCPConn &client, std::string_view args);
+   bool unknownCommand(TCPConn &client, std::string_view readCommand);
+
+   //session states before and around the command menu (login, password change)
+   bool sessionInput(TCPConn &client, std::string_view line);
+   void sendText(TCPConn &client, std::string_view text);
+   void loggedIn(TCPConn &client);
+   bool unknownUser(TCPConn &client);
+
+   void prepareListen();
+   void refreshResponses();
+   TCPConn *openClient(int setSocket, const struct sockaddr *peer);
+   virtual std::unique_ptr<TCPServer> newShard();
+
+   //output queue handling, the engines decide how queued replies reach the socket
+   void queueFlush(TCPConn &client);
+   void finishBatch(TCPConn &client);
+   void noteAccepts(unsigned int count);
+   void deferAccept();
+   //accepts stopped at the fd limit and either a client closed since or the retry delay passed
+   bool acceptRetryDue() const { return this->acceptDeferred && (this->loopNowMs >= this->acceptRetryMs); };
+   void printAcceptStats();
+   void flushPending();
+   void flushClient(TCPConn &client);
+   void readClient(TCPConn &client, uint32_t events);
+   virtual void pauseReading(TCPConn &client);
+   virtual void resumeReading(TCPConn &client);
+   void unpauseReading(TCPConn &client);
+   virtual size_t pendingWrites() const { return this->watchedWrites; };
+   void publishStats();
+   bool belowLowWater(const TCPConn &client) const { return client.output.bytes() <= (this->highWater / 2); };
+   //a paused client may be resumed once its output drained, unless it is also over its command rate
+   //or still waiting on the worker pool
+   bool canResume(const TCPConn &client) const { return client.readPaused && !client.throttled && !client.awaitingWork && belowLowWater(client); };
+
+   //commands too expensive for the loop run on the worker pool, their results come back here
+   enum WorkKind { WORK_REPLY, WORK_USERNAME, WORK_LOGIN };
+   bool offload(TCPConn &client, WorkKind kind, std::function<std::string()> work);
+   bool finishWork(TCPConn &client, work_item &item);
+   void drainCompletions();
+
+   //admission and command rate limits
+   void rejectClient(int setSocket, TCPConn &client);
+   bool takeToken(TCPConn &client);
+   void throttleClient(TCPConn &client);
+
+   //idle and read timeouts, the timer also wakes throttled clients
+   int64_t clientDeadline(const TCPConn &client) const;
+   void armTimer(TCPConn &client);
+   void expireClients();
+   int nextWaitMs() const;
+   static int64_t monotonicMs();
+
+   //stop flag, server socket and client table are shared with the other engines
+   std::atomic<bool> stopRequested{false};
    int socket_FD = 0;
+   ConnTable<TCPConn> clientObj_sockets;
+
+   //this loop's reference to the pre-built replies, and the store version it came from
+   std::shared_ptr<const ResponseSet> responses;
+   uint64_t responsesVersion = 0;
+
+   //clients with replies queued since the last flush
+   std::vector<int> dirtyClients;
+
+   //pending output at which a client stops being read
+   size_t highWater = 262144;
+
+   //one prompt per write instead of one per reply
+   bool batchPrompt = false;
+
+   accept_stats acceptCounters;
 
-   //data structure needed for bind & accept functions
+   //accept hit EMFILE/ENFILE and connections were left queued, retried once a client closes or at
+   //acceptRetryMs (another shard may free the fds), the warning is logged once a second at most
+   bool acceptDeferred = false;
+   int64_t acceptRetryMs = 0;
+   int64_t acceptWarnMs = 0;
+
+   //this loop's counters and command latencies, written only by this loop
+   MetricsShard *metrics = nullptr;
+
+   //gauges for the stats segment: clients paused for backpressure, clients waiting on EPOLLOUT
+   size_t pausedClients = 0;
+   size_t watchedWrites = 0;
+
+   //one timer per client, due at its idle or read deadline or the end of its throttling, and
+   //the loop time it is driven by. 10 ms ticks keep throttled clients from waiting long
+   TimerWheel timers{10};
+   int64_t loopNowMs = 0;
+   int64_t idleTimeoutMs = 0;
+   int64_t readTimeoutMs = 0;
+   std::vector<int> expiredClients;
+
+   //commands per second and burst allowed per client, 0 = unlimited
+   double commandRate = 0;
+   double commandBurst = 0;
+
+   //finished worker pool items for this loop, and the serial given to the next client
+   CompletionQueue completions;
+   uint64_t nextSerial = 0;
+
+   //users clients log in as, shared by every loop, none means no login
+   std::shared_ptr<PasswdMgr> passwords;
+
+   //read blocks handed back by clients with nothing pending, so idle ones hold no buffer
+   line_block_cache readBlocks;
+
+private:
+   void startShards();
+
+   //data structure needed for the bind function
    struct sockaddr_in address; 
 
-   //testing
-   std::vector<std::unique_ptr<socket_obj>> clientObj_sockets;
+   //epoll instance every socket is registered with
+   EventLoop eventLoop;
+
+   //number of event loops to run, this one included
+   unsigned int threadCount = 1;
+
+   //0 for the server created by main, 1..threadCount-1 for its shards
+   unsigned int shardID = 0;
+
+   //listen queue length and TCP_DEFER_ACCEPT timeout (0 = off)
+   int listenBacklog = SOMAXCONN;
+   int deferAcceptSecs = 0;
+
+   //address given to bindSvr, reused by the shards
+   std::string bindIP;
+   unsigned short bindPort = 0;
+
+   //dirtyClients being flushed, kept so its storage is reused every pass
+   std::vector<int> flushBatch;
+
+   //the other event loops, each one a full TCPServer with its own socket and table
+   std::vector<std::unique_ptr<TCPServer>> shards;
+   std::vector<std::thread> shardThreads;
 
 };
 
@@ -0,0 +1,138 @@
+#ifndef TCPURINGSERVER_H
+#define TCPURINGSERVER_H
+
+#include "TCPServer.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+//defined in <linux/io_uring.h>, only the source file needs the full definitions
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+/******************************************************************************************
+ * TCPUringServer - TCPServer engine that drives accept, recv and send through io_uring
+ *
+ *  	   A single multishot accept stays armed on the server socket and every client gets a
+ *  	   multishot recv that picks its buffers from a provided buffer ring, so steady state
+ *  	   reads need no new submissions at all. Replies wait in each client's output queue
+ *  	   and are submitted as one sendmsg per client in a batch per loop pass, which brings
+ *  	   a busy iteration down to a single io_uring_enter call. Replies from the worker
+ *  	   pool are picked up through a multishot poll on the completion queue's eventfd.
+ *
+ *  	   listenSvr - runs the io_uring loop, or falls back to the epoll loop of TCPServer
+ *                   when the kernel does not support the features used here
+ *  	   closeClient - shuts the socket down so its pending operations complete, then closes
+ *
+ *  	   Command handling and output queueing are inherited from TCPServer unchanged.
+ *
+ *****************************************************************************************/
+
+//per fd io_uring bookkeeping, kept separate from TCPConn so the epoll engine does not pay for it
+class uring_conn
+{
+public:
+   //bumped on every accept so completions for an older socket on the same fd are ignored
+   uint32_t generation = 0;
+   bool sendInFlight = false;
+   //multishot recv is active, cleared by its final completion
+   bool recvArmed = false;
+};
+
+//a sendmsg owned by the kernel until it completes, holding the replies it points into
+class uring_send
+{
+public:
+   struct msghdr msg;
+   std::vector<struct iovec> iov;
+   std::vector<Payload> hold;
+};
+
+class TCPUringServer : public TCPServer
+{
+public:
+   TCPUringServer();
+   ~TCPUringServer();
+
+   void listenSvr();
+
+   void closeClient(int inputClientFD);
+
+   // true when the running kernel has everything this engine needs
+   static bool isSupported();
+
+protected:
+   std::unique_ptr<TCPServer> newShard();
+   void pauseReading(TCPConn &client);
+   void resumeReading(TCPConn &client);
+   size_t pendingWrites() const;
+
+private:
+   bool setupRing();
+   void teardownRing();
+
+   struct io_uring_sqe *getSQE();
+   int submitAndWait(unsigned int waitFor, int timeoutMs = -1);
+
+   void armAccept();
+   void armWake();
+   void armRecv(int fd);
+   void cancelRecv(int fd);
+   void flushSends();
+
+   void handleAccept(int res, uint32_t flags);
+   void handleRecv(int fd, uint32_t generation, int res, uint32_t flags);
+   void handleSend(uint64_t userData, int fd, uint32_t generation, int res);
+
+   void recycleBuffer(uint16_t bid);
+   uring_conn &connState(int fd);
+
+   //io_uring instance and its shared rings
+   int ring_FD = -1;
+   void *sqRingPtr = nullptr;
+   void *cqRingPtr = nullptr;
+   size_t sqRingSize = 0;
+   struct io_uring_sqe *sqes = nullptr;
+   size_t sqesSize = 0;
+
+   //pointers into the mapped submission ring
+   unsigned *sqHead = nullptr;
+   unsigned *sqTail = nullptr;
+   unsigned *sqMask = nullptr;
+   unsigned *sqArray = nullptr;
+   unsigned sqEntries = 0;
+   unsigned sqLocalTail = 0;
+   unsigned sqSubmitted = 0;
+
+   //pointers into the mapped completion ring
+   unsigned *cqHead = nullptr;
+   unsigned *cqTail = nullptr;
+   unsigned *cqMask = nullptr;
+   struct io_uring_cqe *cqes = nullptr;
+
+   //provided buffer ring that multishot recv picks its buffers from
+   struct io_uring_buf_ring *bufRing = nullptr;
+   size_t bufRingSize = 0;
+   char *bufPool = nullptr;
+   unsigned bufMask = 0;
+   unsigned short bufTail = 0;
+
+   //indexed by fd
+   std::vector<uring_conn> ringConns;
+
+   //clients accepted while reaping the current batch of completions
+   unsigned int acceptedThisPass = 0;
+
+   //multishot accept is active, left unarmed while accepts are deferred at the fd limit
+   bool acceptArmed = false;
+
+   //sends owned until the kernel reports them complete, keyed by user_data
+   std::unordered_map<uint64_t, uring_send> inflightSends;
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+/******************************************************************************************
+ * TimerWheel - hierarchical timing wheel keyed by file descriptor, one timer per fd
+ *
+ *  	   Four levels of 64 slots. Level 0 slots are one tick wide, each level above covers
+ *  	   64 times the span of the one below, so a deadline up to 2^24 ticks away is one
+ *  	   list insert. Whenever level 0 wraps, the next slot of level 1 is redistributed
+ *  	   downwards (and so on up the levels). Timers are intrusive list nodes indexed by fd,
+ *  	   so schedule and cancel are O(1) and allocation free once the fd has been seen.
+ *  	   A bitmap of occupied slots per level lets nextTimeoutMs find the next deadline
+ *  	   without walking empty slots.
+ *
+ *  	   Deadlines are rounded up to whole ticks, so a timer fires up to one tick late but
+ *  	   never early. Callers that push deadlines back often (every read) should not
+ *  	   reschedule each time: let the timer fire, compare against the real deadline and
+ *  	   schedule again if it moved.
+ *
+ *  	   schedule - sets fd's timer to deadlineMs (on the same clock as advance), moving it
+ *                    if it is already set. advance must have been called once with the
+ *                    current time before the first schedule
+ *  	   cancel - clears fd's timer if there is one
+ *  	   advance - moves the wheel up to nowMs and appends the fds whose timers came due,
+ *                   which are no longer scheduled afterwards
+ *  	   nextTimeoutMs - milliseconds until the wheel needs advancing again, -1 if it is
+ *                         empty (suitable for an epoll timeout)
+ *
+ *****************************************************************************************/
+
+#define TIMER_LEVELS 4
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+
+//one timer, linked into the slot list its deadline falls in
+class timer_node
+{
+public:
+   int prev = -1;
+   int next = -1;
+   //index into TimerWheel::heads, -1 while not scheduled
+   int slot = -1;
+   uint64_t deadlineTick = 0;
+};
+
+class TimerWheel
+{
+public:
+   TimerWheel(unsigned int tickMs = 100);
+   ~TimerWheel();
+
+   void schedule(int fd, int64_t deadlineMs);
+   void cancel(int fd);
+   void advance(int64_t nowMs, std::vector<int> &expired);
+   int nextTimeoutMs(int64_t nowMs) const;
+
+   bool scheduled(int fd) const { return (fd >= 0) && (static_cast<size_t>(fd) < this->nodes.size()) && (this->nodes[fd].slot >= 0); };
+   size_t size() const { return this->count; };
+
+private:
+   void link(int fd, uint64_t deadlineTick);
+   void unlink(int fd);
+   void cascade(int level);
+
+   unsigned int tickMs;
+
+   //last tick advance() has processed, everything scheduled is after it
+   uint64_t currentTick = 0;
+
+   //first node of every slot's list, level by level
+   int heads[TIMER_LEVELS * TIMER_SLOTS];
+   uint64_t occupied[TIMER_LEVELS] = {};
+
+   std::vector<timer_node> nodes;
+   size_t count = 0;
+};
+
+#endif
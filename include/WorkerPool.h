@@ -0,0 +1,110 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+/******************************************************************************************
+ * WorkerPool - bounded pool of threads for commands too expensive to run on an event loop
+ *
+ *  	   A loop wraps the work in a work_item naming itself (its CompletionQueue) and the
+ *  	   client, and submits it. A worker runs it and pushes the item, result filled in,
+ *  	   onto the owning loop's completion queue; the loop picks it up on its next wakeup
+ *  	   and replies. The submission queue is bounded, a full pool refuses new work so the
+ *  	   caller can answer busy instead of letting a backlog build up.
+ *
+ *  	   instance - the pool shared by every event loop
+ *  	   start - starts the worker threads, 0 threads leaves the pool off
+ *  	   stop - finishes the items being worked on, drops the queued ones and joins the
+ *                threads. Call before the event loops owning the queues are destroyed
+ *  	   submit - queues an item, false if the pool is off or full (item still owned by
+ *                  the caller)
+ *  	   execute - runs an item's work into its result, a throwing item gets a failure
+ *                   reply. Used by the workers, and by callers running work inline
+ *
+ *****************************************************************************************/
+
+class CompletionQueue;
+
+//one piece of offloaded work and, once done, its reply
+class work_item
+{
+public:
+   std::function<std::string()> work;
+   std::string result;
+
+   //what the owning loop does with the result, up to the loop
+   unsigned int kind = 0;
+
+   //loop to hand the result back to, and the client it is for
+   CompletionQueue *owner = nullptr;
+   int fd = -1;
+   uint64_t serial = 0;
+
+   //link in the completion queue
+   work_item *next = nullptr;
+};
+
+/******************************************************************************************
+ * CompletionQueue - lock-free multi-producer, single-consumer hand off back to one loop
+ *
+ *  	   Workers push finished items onto an atomic singly linked stack; only a push onto
+ *  	   an empty stack writes the eventfd, so a burst of completions costs the loop one
+ *  	   wakeup. The owning loop watches fd() and calls takeAll, which clears the eventfd,
+ *  	   swaps the whole stack out in one exchange and returns it oldest first.
+ *
+ *  	   Exceptions: the constructor throws socket_error if the eventfd can not be created
+ *
+ *****************************************************************************************/
+
+class CompletionQueue
+{
+public:
+   CompletionQueue();
+   ~CompletionQueue();
+
+   int fd() const { return this->event_FD; };
+
+   void push(work_item *item);
+   work_item *takeAll();
+
+private:
+   std::atomic<work_item *> head{nullptr};
+   int event_FD = -1;
+};
+
+class WorkerPool
+{
+public:
+   static WorkerPool &instance();
+
+   void start(unsigned int threads, size_t maxQueued);
+   void stop();
+   bool running() const { return !this->threads.empty(); };
+
+   bool submit(work_item *item);
+   static void execute(work_item &item);
+
+private:
+   WorkerPool();
+   ~WorkerPool();
+
+   void run();
+
+   std::mutex queueLock;
+   std::condition_variable queueReady;
+   std::deque<work_item *> queue;
+   size_t maxQueued = 0;
+   bool stopping = false;
+
+   std::vector<std::thread> threads;
+};
+
+#endif
@@ -1,4 +1,6 @@
 #include <string>
+#include <string_view>
+#include <cstddef>
 
 // Remove /r and /n from a string
 void clrNewlines(std::string &str);
@@ -12,4 +14,24 @@ void lower(std::string &str);
 // Turns off local echo from a user's terminal
 int hideInput(int fd, bool hide);
 
+// Non-allocating versions of the above. The scans run 16 or 32 bytes at a time (SSE2, or AVX2
+// when the CPU has it, chosen once at run time), so long lines cost little more than short ones.
 
+// Removes every /r and /n from len bytes at data in place, returns the length left
+size_t clrNewlines(char *data, size_t len);
+
+// The string without the /r and /n at its end
+std::string_view trimNewlines(std::string_view str);
+
+// Position of the first /r or /n, or npos
+size_t findNewline(std::string_view str);
+
+// Position of the first delimiter, or npos
+size_t findDelimiter(std::string_view str, const char delimiter);
+
+// Views of the sides of orig around its first delimiter, right without its line ending. Neither
+// side is lowercased, unlike the std::string version
+bool split(std::string_view orig, std::string_view &left, std::string_view &right, const char delimiter);
+
+// Turns len bytes at data into lowercase (ASCII letters only) in place
+void lower(char *data, size_t len);
@@ -0,0 +1,62 @@
+#include "AdmissionControl.h"
+
+AdmissionControl::AdmissionControl() {
+}
+
+AdmissionControl &AdmissionControl::instance() {
+    static AdmissionControl admission;
+    return admission;
+}
+
+void AdmissionControl::setLimits(size_t maxClients, size_t maxPerAddress) {
+    this->maxClients = maxClients;
+    this->maxPerAddress = maxPerAddress;
+}
+
+/**********************************************************************************************
+ * admit - Takes a place for a client from address, or returns false if the server is full or
+ *         the address already has its share. A refused client leaves the counts unchanged.
+ *
+ **********************************************************************************************/
+
+bool AdmissionControl::admit(const std::string &address) {
+    size_t before = this->total.fetch_add(1, std::memory_order_relaxed);
+    if ((this->maxClients > 0) && (before >= this->maxClients))
+    {
+        this->total.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+    if (this->maxPerAddress == 0)
+    {
+        return true;
+    }
+
+    std::lock_guard<std::mutex> guard(this->perAddressLock);
+    size_t &open = this->perAddress[address];
+    if (open >= this->maxPerAddress)
+    {
+        this->total.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+    open++;
+    return true;
+}
+
+void AdmissionControl::release(const std::string &address) {
+    this->total.fetch_sub(1, std::memory_order_relaxed);
+    if (this->maxPerAddress == 0)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(this->perAddressLock);
+    std::unordered_map<std::string, size_t>::iterator entry = this->perAddress.find(address);
+    if (entry == this->perAddress.end())
+    {
+        return;
+    }
+    if (--entry->second == 0)
+    {
+        this->perAddress.erase(entry);
+    }
+}
@@ -0,0 +1,75 @@
+#include "EventLoop.h"
+
+#include <unistd.h>
+#include <errno.h>
+
+#include "exceptions.h"
+
+/**********************************************************************************************
+ * EventLoop (constructor) - Creates the epoll instance. maxEvents caps how many ready fds are
+ *                           handed back by a single wait() call, not how many can be watched.
+ *
+ *    Throws: socket_error if epoll could not be created
+ **********************************************************************************************/
+
+EventLoop::EventLoop(int maxEvents):readyEvents(maxEvents) {
+    this->epoll_FD = epoll_create1(EPOLL_CLOEXEC);
+    if (this->epoll_FD < 0)
+    {
+        throw socket_error("epoll_create1 failed");
+    }
+}
+
+EventLoop::~EventLoop() {
+    if (this->epoll_FD >= 0)
+    {
+        close(this->epoll_FD);
+    }
+}
+
+//registers a new file descriptor with the requested event mask
+void EventLoop::add(int fd, uint32_t events) {
+    struct epoll_event ev = {};
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(this->epoll_FD, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        throw socket_error("epoll_ctl add failed");
+    }
+}
+
+//changes the event mask of an already registered file descriptor
+void EventLoop::modify(int fd, uint32_t events) {
+    struct epoll_event ev = {};
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(this->epoll_FD, EPOLL_CTL_MOD, fd, &ev) < 0)
+    {
+        throw socket_error("epoll_ctl modify failed");
+    }
+}
+
+//stops watching a file descriptor, a closed fd is dropped by the kernel anyway so errors are ignored
+void EventLoop::remove(int fd) {
+    epoll_ctl(this->epoll_FD, EPOLL_CTL_DEL, fd, NULL);
+}
+
+/**********************************************************************************************
+ * wait - Sleeps until something is ready. Returns the number of ready events, 0 on timeout or
+ *        when interrupted by a signal.
+ *
+ *    Throws: socket_error if epoll_wait fails for any reason other than EINTR
+ **********************************************************************************************/
+
+int EventLoop::wait(int timeoutMs) {
+    int ready = epoll_wait(this->epoll_FD, this->readyEvents.data(), static_cast<int>(this->readyEvents.size()), timeoutMs);
+    if (ready < 0)
+    {
+        if (errno == EINTR)
+        {
+            return 0;
+        }
+        throw socket_error("epoll_wait failed");
+    }
+    return ready;
+}
@@ -0,0 +1,134 @@
+#include "LineBuffer.h"
+
+#include <string.h>
+#include <utility>
+
+LineBuffer::LineBuffer() {
+}
+
+LineBuffer::~LineBuffer() {
+}
+
+LineBuffer::LineBuffer(LineBuffer &&other) noexcept {
+    *this = std::move(other);
+}
+
+LineBuffer &LineBuffer::operator=(LineBuffer &&other) noexcept {
+    this->storage = std::move(other.storage);
+    this->capacity = other.capacity;
+    this->readPos = other.readPos;
+    this->writePos = other.writePos;
+    this->scanPos = other.scanPos;
+    other.capacity = 0;
+    other.readPos = other.writePos = other.scanPos = 0;
+    return *this;
+}
+
+/**********************************************************************************************
+ * writePtr - Makes sure at least minSpace bytes are free at the tail. Consumed bytes at the
+ *            front are reclaimed first, the block only grows (doubling) when the unread data
+ *            itself does not leave enough room.
+ *
+ **********************************************************************************************/
+
+char *LineBuffer::writePtr(size_t minSpace) {
+    if (this->writable() >= minSpace)
+    {
+        return this->storage.get() + this->writePos;
+    }
+
+    size_t unread = this->pending();
+    if (unread + minSpace <= this->capacity)
+    {
+        //slides the unread tail to the front, scan position moves with it
+        memmove(this->storage.get(), this->storage.get() + this->readPos, unread);
+    }
+    else
+    {
+        size_t newCapacity = (this->capacity == 0) ? minSpace : static_cast<size_t>(this->capacity) * 2;
+        while (newCapacity < unread + minSpace)
+        {
+            newCapacity *= 2;
+        }
+        std::unique_ptr<char[]> grown(new char[newCapacity]);
+        if (unread > 0)
+        {
+            memcpy(grown.get(), this->storage.get() + this->readPos, unread);
+        }
+        this->storage = std::move(grown);
+        this->capacity = newCapacity;
+    }
+    this->scanPos -= this->readPos;
+    this->writePos = unread;
+    this->readPos = 0;
+    return this->storage.get() + this->writePos;
+}
+
+void LineBuffer::append(const char *data, size_t n) {
+    memcpy(writePtr(n), data, n);
+    commit(n);
+}
+
+/**********************************************************************************************
+ * nextLine - Searches only the bytes that arrived since the last call. On a hit the line is
+ *            handed out as a view and consumed; once everything is consumed the positions
+ *            reset so the next read starts at the front again.
+ *
+ **********************************************************************************************/
+
+bool LineBuffer::nextLine(std::string_view &line) {
+    if (this->scanPos < this->writePos)
+    {
+        char *start = this->storage.get();
+        char *newline = static_cast<char *>(memchr(start + this->scanPos, '\n', this->writePos - this->scanPos));
+        if (newline != NULL)
+        {
+            size_t end = newline - start;
+            line = std::string_view(start + this->readPos, end - this->readPos);
+            this->readPos = this->scanPos = end + 1;
+            if (this->readPos == this->writePos)
+            {
+                this->readPos = this->writePos = this->scanPos = 0;
+            }
+            return true;
+        }
+        this->scanPos = this->writePos;
+    }
+    return false;
+}
+
+//drops everything buffered, the block is kept for reuse
+void LineBuffer::clear() {
+    this->readPos = this->writePos = this->scanPos = 0;
+}
+
+void LineBuffer::release() {
+    if (this->pending() == 0)
+    {
+        this->storage.reset();
+        this->capacity = 0;
+        clear();
+    }
+}
+
+//an emptied standard block is kept for the next connection that reads, others are freed
+void LineBuffer::release(line_block_cache &cache) {
+    if ((this->pending() == 0) && (this->capacity == cache.blockSize) && (cache.blocks.size() < cache.maxBlocks))
+    {
+        cache.blocks.push_back(std::move(this->storage));
+        this->capacity = 0;
+        clear();
+        return;
+    }
+    release();
+}
+
+void LineBuffer::attach(line_block_cache &cache) {
+    if ((this->capacity == 0) && !cache.blocks.empty())
+    {
+        this->storage = std::move(cache.blocks.back());
+        cache.blocks.pop_back();
+        this->capacity = cache.blockSize;
+        clear();
+    }
+}
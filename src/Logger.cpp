@@ -0,0 +1,238 @@
+#include "Logger.h"
+
+#include <chrono>
+#include <stdarg.h>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+//how long the flusher sleeps when every ring was empty
+#define FLUSH_INTERVAL_MS 5
+
+static_assert(sizeof(LogRecord) <= LOG_RECORD_SIZE, "log record grew past its slot size");
+
+static const char *const levelNames[] = { "DEBUG", "INFO ", "WARN ", "ERROR" };
+
+Logger::Logger() {
+}
+
+Logger::~Logger() {
+    stop();
+}
+
+Logger &Logger::instance() {
+    static Logger logger;
+    return logger;
+}
+
+/**********************************************************************************************
+ * start - Opens the log output and starts the flusher thread. An empty path logs to stderr.
+ *
+ *    Throws: runtime_error if the file can not be opened
+ **********************************************************************************************/
+
+void Logger::start(const std::string &path) {
+    if (this->running.load())
+    {
+        return;
+    }
+    if (!path.empty())
+    {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Unable to open log file " + path + ": " + strerror(errno));
+        }
+        this->outputFD = fd;
+        this->ownsOutput = true;
+    }
+    this->running.store(true);
+    this->flusher = std::thread(&Logger::flushLoop, this);
+}
+
+//writes whatever is still buffered, also used at exit when start was never called
+void Logger::stop() {
+    if (this->running.exchange(false))
+    {
+        this->flusher.join();
+    }
+
+    std::string batch;
+    while (drain(batch))
+    {
+        writeBatch(batch);
+        batch.clear();
+    }
+
+    if (this->ownsOutput)
+    {
+        close(this->outputFD);
+        this->outputFD = 2;
+        this->ownsOutput = false;
+    }
+}
+
+//the calling thread's ring, created and registered the first time the thread logs
+LogRing *Logger::threadRing() {
+    static thread_local LogRing *ring = nullptr;
+    if (ring == nullptr)
+    {
+        std::unique_ptr<LogRing> created = std::make_unique<LogRing>();
+        ring = created.get();
+        std::lock_guard<std::mutex> guard(this->ringsLock);
+        this->rings.push_back(std::move(created));
+    }
+    return ring;
+}
+
+/**********************************************************************************************
+ * log - Formats a message straight into the next free record of the thread's ring. Never
+ *       blocks and never allocates after the ring exists, a full ring drops the message.
+ *
+ **********************************************************************************************/
+
+void Logger::log(LogLevel level, const char *format, ...) {
+    LogRing *ring = threadRing();
+    uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+    if (tail - ring->head.load(std::memory_order_acquire) >= LOG_RING_RECORDS)
+    {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    LogRecord &record = ring->records[tail % LOG_RING_RECORDS];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(record.text, sizeof(record.text), format, args);
+    va_end(args);
+    if (length < 0)
+    {
+        length = 0;
+    }
+    if (static_cast<size_t>(length) >= sizeof(record.text))
+    {
+        length = sizeof(record.text) - 1;
+    }
+    record.length = static_cast<uint16_t>(length);
+    record.level = static_cast<uint8_t>(level);
+    record.timeUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    ring->tail.store(tail + 1, std::memory_order_release);
+}
+
+/**********************************************************************************************
+ * drain - Moves every published record into batch as one line each, timestamps formatted
+ *         here rather than by the logging thread. Returns false if there was nothing to do.
+ *
+ **********************************************************************************************/
+
+bool Logger::drain(std::string &batch) {
+    std::vector<LogRing *> current;
+    {
+        std::lock_guard<std::mutex> guard(this->ringsLock);
+        current.reserve(this->rings.size());
+        for (std::unique_ptr<LogRing> &ring : this->rings)
+        {
+            current.push_back(ring.get());
+        }
+    }
+
+    //the date and time part only changes once a second
+    static thread_local time_t cachedSecond = -1;
+    static thread_local char cachedStamp[32];
+
+    bool found = false;
+    for (LogRing *ring : current)
+    {
+        uint32_t head = ring->head.load(std::memory_order_relaxed);
+        uint32_t tail = ring->tail.load(std::memory_order_acquire);
+        for (; head != tail; head++)
+        {
+            const LogRecord &record = ring->records[head % LOG_RING_RECORDS];
+            time_t second = static_cast<time_t>(record.timeUs / 1000000);
+            if (second != cachedSecond)
+            {
+                struct tm local;
+                localtime_r(&second, &local);
+                strftime(cachedStamp, sizeof(cachedStamp), "%Y-%m-%d %H:%M:%S", &local);
+                cachedSecond = second;
+            }
+            char prefix[64];
+            int prefixLen = snprintf(prefix, sizeof(prefix), "%s.%06d %s ", cachedStamp,
+                                     static_cast<int>(record.timeUs % 1000000), levelNames[record.level & 3]);
+            batch.append(prefix, prefixLen);
+            batch.append(record.text, record.length);
+            if ((record.length == 0) || (record.text[record.length - 1] != '\n'))
+            {
+                batch.push_back('\n');
+            }
+            found = true;
+        }
+        ring->head.store(tail, std::memory_order_release);
+
+        uint64_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0)
+        {
+            batch.append("WARN  ").append(std::to_string(dropped)).append(" log messages dropped, ring full\n");
+            found = true;
+        }
+    }
+    return found;
+}
+
+//flusher thread body: drain, one write per pass, sleep only when idle
+void Logger::flushLoop() {
+    std::string batch;
+    while (this->running.load(std::memory_order_relaxed))
+    {
+        batch.clear();
+        if (!drain(batch))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(FLUSH_INTERVAL_MS));
+            continue;
+        }
+        writeBatch(batch);
+    }
+}
+
+//one write for the whole batch unless the output takes it in pieces
+void Logger::writeBatch(const std::string &batch) {
+    for (size_t done = 0; done < batch.size(); )
+    {
+        ssize_t written = write(this->outputFD, batch.data() + done, batch.size() - done);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+        done += written;
+    }
+}
+
+//level name from the command line, fallback if it is not one of debug, info, warn, error
+LogLevel Logger::parseLevel(const std::string &name, LogLevel fallback) {
+    if (name == "debug")
+    {
+        return LOG_LEVEL_DEBUG;
+    }
+    if (name == "info")
+    {
+        return LOG_LEVEL_INFO;
+    }
+    if (name == "warn")
+    {
+        return LOG_LEVEL_WARN;
+    }
+    if (name == "error")
+    {
+        return LOG_LEVEL_ERROR;
+    }
+    return fallback;
+}
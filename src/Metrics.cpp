@@ -0,0 +1,433 @@
+#include "Metrics.h"
+#include "StatsSegment.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//networking headers
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "exceptions.h"
+#include "Logger.h"
+
+static int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//index of the bucket a value falls in: exact below 2^METRIC_SUB_BITS, log-linear above
+unsigned int LatencyHistogram::bucketFor(uint64_t ns) {
+    if (ns < (1ULL << METRIC_SUB_BITS))
+    {
+        return static_cast<unsigned int>(ns);
+    }
+    unsigned int msb = 63 - __builtin_clzll(ns);
+    if (msb >= METRIC_MAX_BITS)
+    {
+        return METRIC_BUCKETS - 1;
+    }
+    unsigned int sub = static_cast<unsigned int>(ns >> (msb - METRIC_SUB_BITS)) & ((1U << METRIC_SUB_BITS) - 1);
+    return ((msb - METRIC_SUB_BITS + 1) << METRIC_SUB_BITS) + sub;
+}
+
+//smallest value that lands in a bucket
+uint64_t LatencyHistogram::bucketLow(unsigned int bucket) {
+    if (bucket < (1U << METRIC_SUB_BITS))
+    {
+        return bucket;
+    }
+    unsigned int shift = (bucket >> METRIC_SUB_BITS) - 1;
+    uint64_t sub = bucket & ((1U << METRIC_SUB_BITS) - 1);
+    return ((1ULL << METRIC_SUB_BITS) + sub) << shift;
+}
+
+void LatencyHistogram::record(uint64_t ns) {
+    std::atomic<uint64_t> &bucket = this->buckets[bucketFor(ns)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    this->count.store(this->count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    this->totalNs.store(this->totalNs.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+    if (ns > this->maxNs.load(std::memory_order_relaxed))
+    {
+        this->maxNs.store(ns, std::memory_order_relaxed);
+    }
+}
+
+/**********************************************************************************************
+ * publish - Copies the shard into its shared memory block under the seqlock. Called by the
+ *           owning loop once per pass, so readers see values at most one pass old.
+ *
+ **********************************************************************************************/
+
+void MetricsShard::publish(uint64_t connections, uint64_t pausedClients, uint64_t pendingWrites) {
+    stats_loop_block *block = this->published;
+    if (block == nullptr)
+    {
+        return;
+    }
+    block->beginWrite();
+    for (int c = 0; c < MET_COUNTER_COUNT; c++)
+    {
+        block->counters[c].store(this->counters[c].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    for (int i = 0; i < METRIC_MAX_COMMANDS; i++)
+    {
+        block->commands[i].store(this->commands[i].count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    block->connections.store(connections, std::memory_order_relaxed);
+    block->pausedClients.store(pausedClients, std::memory_order_relaxed);
+    block->pendingWrites.store(pendingWrites, std::memory_order_relaxed);
+    block->endWrite();
+}
+
+void MetricsShard::recordCommand(unsigned int id, uint64_t ns) {
+    if (id >= METRIC_MAX_COMMANDS)
+    {
+        id = METRIC_MAX_COMMANDS - 1;
+    }
+    add(MET_COMMANDS, 1);
+    this->commands[id].record(ns);
+}
+
+/**********************************************************************************************
+ * percentileNs - Value below which the given fraction of a command's samples fall, reported
+ *                as the upper edge of the bucket it lands in (never above the largest sample).
+ *
+ **********************************************************************************************/
+
+uint64_t MetricsSnapshot::percentileNs(unsigned int id, double fraction) const {
+    uint64_t total = this->commandCount[id];
+    if (total == 0)
+    {
+        return 0;
+    }
+    uint64_t target = static_cast<uint64_t>(fraction * total);
+    if (target < 1)
+    {
+        target = 1;
+    }
+    const uint64_t *hist = &this->buckets[static_cast<size_t>(id) * METRIC_BUCKETS];
+    uint64_t seen = 0;
+    for (unsigned int b = 0; b < METRIC_BUCKETS; b++)
+    {
+        seen += hist[b];
+        if (seen >= target)
+        {
+            uint64_t upper = (b + 1 < METRIC_BUCKETS) ? LatencyHistogram::bucketLow(b + 1) - 1 : this->commandMaxNs[id];
+            return (upper < this->commandMaxNs[id]) ? upper : this->commandMaxNs[id];
+        }
+    }
+    return this->commandMaxNs[id];
+}
+
+Metrics::Metrics() {
+    this->startedMs = nowMs();
+    this->commandNames[METRIC_MAX_COMMANDS - 1] = "unknown";
+}
+
+Metrics::~Metrics() {
+    stopAdmin();
+    closeSegment();
+}
+
+Metrics &Metrics::instance() {
+    static Metrics metrics;
+    return metrics;
+}
+
+//registers a shard for a new event loop, the only time recording threads take the lock
+MetricsShard *Metrics::newShard() {
+    std::unique_ptr<MetricsShard> shard = std::make_unique<MetricsShard>();
+    MetricsShard *created = shard.get();
+    std::lock_guard<std::mutex> guard(this->shardsLock);
+    this->shards.push_back(std::move(shard));
+
+    if (this->segment != nullptr)
+    {
+        uint32_t slot = this->segment->loopCount.load(std::memory_order_relaxed);
+        if (slot < STATS_MAX_LOOPS)
+        {
+            created->published = &this->segment->loops[slot];
+            this->segment->loopCount.store(slot + 1, std::memory_order_release);
+        }
+    }
+    return created;
+}
+
+void Metrics::nameCommand(unsigned int id, std::string_view name) {
+    if (id >= METRIC_MAX_COMMANDS - 1)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(this->shardsLock);
+    this->commandNames[id] = name;
+    if (this->segment != nullptr)
+    {
+        size_t length = (name.size() < STATS_NAME_LENGTH - 1) ? name.size() : STATS_NAME_LENGTH - 1;
+        memcpy(this->segment->commandNames[id], name.data(), length);
+        this->segment->commandNames[id][length] = '\0';
+    }
+}
+
+/**********************************************************************************************
+ * openSegment - Creates the shared memory segment readers attach to. A leftover one from an
+ *               earlier run is unlinked and a new one created, never resized, since a
+ *               tcpserver-stat still attached to it would fault on the truncated pages.
+ *               Must be called before the event loops are created, each loop's shard gets
+ *               a block.
+ *
+ *    Throws: runtime_error if the segment belongs to a running server or can not be
+ *            created or mapped
+ **********************************************************************************************/
+
+void Metrics::openSegment(const std::string &name) {
+    //another server on the same port keeps its segment, it will fail to bind anyway
+    int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (fd >= 0)
+    {
+        struct stat info;
+        pid_t owner = 0;
+        if ((fstat(fd, &info) == 0) && (static_cast<size_t>(info.st_size) >= sizeof(stats_segment)))
+        {
+            void *old = mmap(NULL, sizeof(stats_segment), PROT_READ, MAP_SHARED, fd, 0);
+            if (old != MAP_FAILED)
+            {
+                const stats_segment *existing = static_cast<const stats_segment *>(old);
+                if ((existing->magic == STATS_SEGMENT_MAGIC) && (existing->serverPID != getpid()) && writerAlive(*existing))
+                {
+                    owner = existing->serverPID;
+                }
+                munmap(old, sizeof(stats_segment));
+            }
+        }
+        close(fd);
+        if (owner != 0)
+        {
+            throw std::runtime_error("Stats segment " + name + " is in use by tcpserver pid " + std::to_string(owner));
+        }
+        shm_unlink(name.c_str());
+    }
+
+    fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Unable to create stats segment " + name + ": " + strerror(errno));
+    }
+    if (ftruncate(fd, sizeof(stats_segment)) < 0)
+    {
+        close(fd);
+        shm_unlink(name.c_str());
+        throw std::runtime_error("Unable to size stats segment " + name);
+    }
+    void *mapped = mmap(NULL, sizeof(stats_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        shm_unlink(name.c_str());
+        throw std::runtime_error("Unable to map stats segment " + name);
+    }
+
+    //zero filled memory is a valid stats_segment, only the identification needs writing
+    stats_segment *created = static_cast<stats_segment *>(mapped);
+    created->version = STATS_SEGMENT_VERSION;
+    created->serverPID = getpid();
+    created->serverStartTicks = processStartTicks(created->serverPID);
+    created->startedMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    std::lock_guard<std::mutex> guard(this->shardsLock);
+    for (unsigned int id = 0; id < METRIC_MAX_COMMANDS; id++)
+    {
+        std::string_view label = this->commandNames[id];
+        size_t length = (label.size() < STATS_NAME_LENGTH - 1) ? label.size() : STATS_NAME_LENGTH - 1;
+        if (length > 0)
+        {
+            memcpy(created->commandNames[id], label.data(), length);
+        }
+    }
+    __atomic_store_n(&created->magic, STATS_SEGMENT_MAGIC, __ATOMIC_RELEASE);
+    this->segment = created;
+    this->segmentName = name;
+}
+
+//unmaps and removes the segment, readers still attached keep their mapping
+void Metrics::closeSegment() {
+    if (this->segment == nullptr)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(this->shardsLock);
+    for (std::unique_ptr<MetricsShard> &shard : this->shards)
+    {
+        shard->published = nullptr;
+    }
+    munmap(this->segment, sizeof(stats_segment));
+    shm_unlink(this->segmentName.c_str());
+    this->segment = nullptr;
+}
+
+/**********************************************************************************************
+ * collect - Sums every shard into one snapshot. The loops keep writing while this runs, so
+ *           the totals are a consistent-enough view rather than an exact instant.
+ *
+ **********************************************************************************************/
+
+MetricsSnapshot Metrics::collect() {
+    MetricsSnapshot snapshot;
+    snapshot.buckets.assign(static_cast<size_t>(METRIC_MAX_COMMANDS) * METRIC_BUCKETS, 0);
+    snapshot.uptimeSecs = (nowMs() - this->startedMs) / 1000.0;
+
+    std::lock_guard<std::mutex> guard(this->shardsLock);
+    for (std::unique_ptr<MetricsShard> &shard : this->shards)
+    {
+        for (int c = 0; c < MET_COUNTER_COUNT; c++)
+        {
+            snapshot.counters[c] += shard->counters[c].load(std::memory_order_relaxed);
+        }
+        for (unsigned int id = 0; id < METRIC_MAX_COMMANDS; id++)
+        {
+            const LatencyHistogram &hist = shard->commands[id];
+            uint64_t count = hist.count.load(std::memory_order_relaxed);
+            if (count == 0)
+            {
+                continue;
+            }
+            snapshot.commandCount[id] += count;
+            snapshot.commandTotalNs[id] += hist.totalNs.load(std::memory_order_relaxed);
+            uint64_t maxNs = hist.maxNs.load(std::memory_order_relaxed);
+            if (maxNs > snapshot.commandMaxNs[id])
+            {
+                snapshot.commandMaxNs[id] = maxNs;
+            }
+            uint64_t *merged = &snapshot.buckets[static_cast<size_t>(id) * METRIC_BUCKETS];
+            for (unsigned int b = 0; b < METRIC_BUCKETS; b++)
+            {
+                merged[b] += hist.buckets[b].load(std::memory_order_relaxed);
+            }
+        }
+    }
+    return snapshot;
+}
+
+//the merged metrics as text, one line per command that has been used
+std::string Metrics::report() {
+    MetricsSnapshot snapshot = collect();
+    char line[160];
+    std::string text;
+
+    uint64_t accepted = snapshot.counters[MET_ACCEPTED];
+    uint64_t closed = snapshot.counters[MET_CLOSED];
+    uint64_t commands = snapshot.counters[MET_COMMANDS];
+    double uptime = (snapshot.uptimeSecs > 0) ? snapshot.uptimeSecs : 1;
+
+    snprintf(line, sizeof(line), "uptime: %.1fs\n", snapshot.uptimeSecs);
+    text.append(line);
+    snprintf(line, sizeof(line), "connections: %llu active, %llu accepted, %llu closed, %llu rejected\n",
+             (unsigned long long)(accepted - closed), (unsigned long long)accepted, (unsigned long long)closed,
+             (unsigned long long)snapshot.counters[MET_REJECTED]);
+    text.append(line);
+    snprintf(line, sizeof(line), "bytes: %llu in, %llu out\n",
+             (unsigned long long)snapshot.counters[MET_BYTES_IN], (unsigned long long)snapshot.counters[MET_BYTES_OUT]);
+    text.append(line);
+    snprintf(line, sizeof(line), "commands: %llu total, %.1f/s, %llu read pauses, %llu throttled, %llu timeouts\n",
+             (unsigned long long)commands, commands / uptime, (unsigned long long)snapshot.counters[MET_READ_PAUSES],
+             (unsigned long long)snapshot.counters[MET_THROTTLED], (unsigned long long)snapshot.counters[MET_TIMEOUTS]);
+    text.append(line);
+    snprintf(line, sizeof(line), "%-10s %10s %10s %10s %10s %10s %10s\n", "command", "count", "mean_us", "p50_us", "p99_us", "p99.9_us", "max_us");
+    text.append(line);
+
+    std::lock_guard<std::mutex> guard(this->shardsLock);
+    for (unsigned int id = 0; id < METRIC_MAX_COMMANDS; id++)
+    {
+        uint64_t count = snapshot.commandCount[id];
+        if ((count == 0) || this->commandNames[id].empty())
+        {
+            continue;
+        }
+        std::string name(this->commandNames[id]);
+        snprintf(line, sizeof(line), "%-10s %10llu %10.2f %10.2f %10.2f %10.2f %10.2f\n", name.c_str(), (unsigned long long)count,
+                 (snapshot.commandTotalNs[id] / static_cast<double>(count)) / 1000.0,
+                 snapshot.percentileNs(id, 0.50) / 1000.0, snapshot.percentileNs(id, 0.99) / 1000.0,
+                 snapshot.percentileNs(id, 0.999) / 1000.0, snapshot.commandMaxNs[id] / 1000.0);
+        text.append(line);
+    }
+    return text;
+}
+
+/**********************************************************************************************
+ * startAdmin - Opens the admin listener on ip:port. Every connection gets the report and is
+ *              closed, so `nc host port` is enough to read it. Runs on its own thread so the
+ *              event loops never see it.
+ *
+ *    Throws: socket_error if the socket can not be bound
+ **********************************************************************************************/
+
+void Metrics::startAdmin(const std::string &ip, unsigned short port) {
+    this->admin_FD = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (this->admin_FD < 0)
+    {
+        throw socket_error("Admin socket failed");
+    }
+    int optVal = 1;
+    setsockopt(this->admin_FD, SOL_SOCKET, SO_REUSEADDR, &optVal, sizeof(optVal));
+
+    struct sockaddr_in adminAddr;
+    memset(&adminAddr, 0, sizeof(adminAddr));
+    adminAddr.sin_family = AF_INET;
+    adminAddr.sin_addr.s_addr = inet_addr(ip.c_str());
+    adminAddr.sin_port = htons(port);
+    if ((bind(this->admin_FD, reinterpret_cast<struct sockaddr *>(&adminAddr), sizeof(adminAddr)) < 0) || (listen(this->admin_FD, 16) < 0))
+    {
+        close(this->admin_FD);
+        this->admin_FD = -1;
+        throw socket_error("Admin listener bind failed");
+    }
+
+    this->adminRunning.store(true);
+    this->adminThread = std::thread(&Metrics::adminLoop, this);
+    LOG_INFO("Stats listener on %s port %u", ip.c_str(), port);
+}
+
+//wakes the admin thread out of accept and waits for it
+void Metrics::stopAdmin() {
+    if (!this->adminRunning.exchange(false))
+    {
+        return;
+    }
+    ::shutdown(this->admin_FD, SHUT_RDWR);
+    this->adminThread.join();
+    close(this->admin_FD);
+    this->admin_FD = -1;
+}
+
+void Metrics::adminLoop() {
+    while (this->adminRunning.load())
+    {
+        int clientFD = accept4(this->admin_FD, NULL, NULL, SOCK_CLOEXEC);
+        if (clientFD < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            return;
+        }
+        std::string text = report();
+        for (size_t done = 0; done < text.size(); )
+        {
+            ssize_t written = send(clientFD, text.data() + done, text.size() - done, MSG_NOSIGNAL);
+            if (written <= 0)
+            {
+                break;
+            }
+            done += written;
+        }
+        close(clientFD);
+    }
+}
@@ -0,0 +1,132 @@
+#include "OutputQueue.h"
+
+#include <errno.h>
+#include <memory>
+#include <string>
+#include <sys/socket.h>
+
+OutputQueue::OutputQueue() {
+}
+
+OutputQueue::~OutputQueue() {
+}
+
+void OutputQueue::push(const Payload &payload, size_t trim) {
+    if (payload->size() <= trim)
+    {
+        return;
+    }
+    OutputSlice slice;
+    slice.data = payload;
+    slice.end = payload->size() - trim;
+    this->pendingBytes += slice.end;
+    this->slices.push_back(std::move(slice));
+}
+
+//replies built per request (client IP, unknown command) get their own buffer
+void OutputQueue::push(std::string_view text) {
+    if (text.empty())
+    {
+        return;
+    }
+    push(std::make_shared<const std::string>(text));
+}
+
+/**********************************************************************************************
+ * gather - Describes up to maxIov unsent slices as iovecs. When hold is given a reference to
+ *          each Payload is copied into it, so the memory stays valid even if the queue is
+ *          cleared before an asynchronous write completes.
+ *
+ **********************************************************************************************/
+
+int OutputQueue::gather(struct iovec *iov, int maxIov, std::vector<Payload> *hold) const {
+    int count = 0;
+    for (size_t i = this->head; (i < this->slices.size()) && (count < maxIov); i++)
+    {
+        const OutputSlice &slice = this->slices[i];
+        iov[count].iov_base = const_cast<char *>(slice.data->data() + slice.offset);
+        iov[count].iov_len = slice.end - slice.offset;
+        if (hold != nullptr)
+        {
+            hold->push_back(slice.data);
+        }
+        count++;
+    }
+    return count;
+}
+
+//drops written bytes, releasing every slice that is now fully sent
+void OutputQueue::consume(size_t n) {
+    if (n >= this->pendingBytes)
+    {
+        clear();
+        return;
+    }
+    this->pendingBytes -= n;
+    while (n > 0)
+    {
+        OutputSlice &slice = this->slices[this->head];
+        size_t left = slice.end - slice.offset;
+        if (n < left)
+        {
+            slice.offset += n;
+            break;
+        }
+        n -= left;
+        slice.data.reset();
+        this->head++;
+    }
+
+    //keeps the sent prefix from piling up in front of a long lived backlog
+    if ((this->head >= 32) && (this->head * 2 >= this->slices.size()))
+    {
+        this->slices.erase(this->slices.begin(), this->slices.begin() + this->head);
+        this->head = 0;
+    }
+}
+
+/**********************************************************************************************
+ * writeTo - Writes as much as the socket accepts right now, several slices per syscall.
+ *           MSG_DONTWAIT keeps this non-blocking even on a blocking socket and MSG_NOSIGNAL
+ *           turns a closed peer into EPIPE instead of SIGPIPE.
+ *
+ **********************************************************************************************/
+
+ssize_t OutputQueue::writeTo(int fd) {
+    ssize_t total = 0;
+    struct iovec iov[OUTPUT_MAX_IOV];
+    while (!empty())
+    {
+        struct msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = gather(iov, OUTPUT_MAX_IOV);
+
+        ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                break;
+            }
+            return -1;
+        }
+        consume(sent);
+        total += sent;
+    }
+    return total;
+}
+
+void OutputQueue::clear() {
+    this->slices.clear();
+    //a backlog's worth of capacity goes back once it drained, a few slots stay for the next replies
+    if (this->slices.capacity() > OUTPUT_KEPT_SLICES)
+    {
+        std::vector<OutputSlice>().swap(this->slices);
+    }
+    this->head = 0;
+    this->pendingBytes = 0;
+}
@@ -0,0 +1,630 @@
+#include "config.h"
+#include "PasswdMgr.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <mutex>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/random.h>
+
+#ifdef HAVE_ARGON2
+#include <argon2.h>
+#endif
+#ifdef HAVE_LIBCRYPTO
+#include <openssl/evp.h>
+#endif
+
+//first bytes of every store file
+#define PASSWD_MAGIC "PWSTORE1"
+
+//Argon2id passes and memory, PBKDF2 iterations, for new records
+#define ARGON2_PASSES 2
+#define ARGON2_MEMORY_KIB 19456
+#define PBKDF2_ITERATIONS 600000
+
+//superseded records tolerated before a write compacts the file, and never fewer than live ones
+#define COMPACT_MIN_SUPERSEDED 64
+
+//file header, records follow it
+struct passwd_header
+{
+   char magic[8];
+   uint32_t recordSize;
+   uint8_t pad[52];
+};
+
+static_assert(sizeof(passwd_header) == 64, "passwd_header is part of the on-disk format");
+
+static uint32_t fnv1a(const void *data, size_t length) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t recordChecksum(const passwd_record &record) {
+    uint32_t sum = fnv1a(reinterpret_cast<const char *>(&record) + sizeof(record.checksum), sizeof(record) - sizeof(record.checksum));
+    return (sum == 0) ? 1 : sum;
+}
+
+//compares every byte whatever the first difference, so the time taken says nothing about the hash
+static bool sameHash(const uint8_t *a, const uint8_t *b) {
+    uint8_t diff = 0;
+    for (int i = 0; i < PASSWD_HASH_LEN; i++)
+    {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+PasswdMgr::PasswdMgr(const char *pwd_file):path(pwd_file) {
+    openFile();
+}
+
+PasswdMgr::~PasswdMgr() {
+    closeFile();
+}
+
+PasswdAlgorithm PasswdMgr::defaultAlgorithm() {
+#ifdef HAVE_ARGON2
+    return PWD_ALG_ARGON2ID;
+#elif defined(HAVE_LIBCRYPTO)
+    return PWD_ALG_PBKDF2_SHA256;
+#else
+    return PWD_ALG_NONE;
+#endif
+}
+
+/**********************************************************************************************
+ * openFile - Opens (creating it with a header if needed) and maps the store, then indexes
+ *            every record in it.
+ *
+ *    Throws: runtime_error if the file can not be opened or mapped, or is not a store
+ **********************************************************************************************/
+
+void PasswdMgr::openFile() {
+    this->fd = open(this->path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (this->fd < 0)
+    {
+        throw std::runtime_error("Unable to open password file " + this->path + ": " + strerror(errno));
+    }
+
+    struct stat st;
+    if (fstat(this->fd, &st) < 0)
+    {
+        closeFile();
+        throw std::runtime_error("Unable to stat password file " + this->path);
+    }
+
+    //a new file gets its header under the write lock, another process may be creating it too
+    if (st.st_size == 0)
+    {
+        flock(this->fd, LOCK_EX);
+        fstat(this->fd, &st);
+        if (st.st_size == 0)
+        {
+            passwd_header header;
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, PASSWD_MAGIC, sizeof(header.magic));
+            header.recordSize = sizeof(passwd_record);
+            if ((pwrite(this->fd, &header, sizeof(header), 0) != sizeof(header)) || (fsync(this->fd) < 0))
+            {
+                flock(this->fd, LOCK_UN);
+                closeFile();
+                throw std::runtime_error("Unable to write password file " + this->path);
+            }
+            fstat(this->fd, &st);
+        }
+        flock(this->fd, LOCK_UN);
+    }
+
+    passwd_header header;
+    if ((pread(this->fd, &header, sizeof(header), 0) != sizeof(header)) || (memcmp(header.magic, PASSWD_MAGIC, sizeof(header.magic)) != 0)
+        || (header.recordSize != sizeof(passwd_record)))
+    {
+        closeFile();
+        throw std::runtime_error(this->path + " is not a password file");
+    }
+
+    this->inode = st.st_ino;
+    this->fileBytes = st.st_size;
+    this->recordCount = 0;
+    this->live = 0;
+    this->index.assign(64, index_slot{0, 0});
+    mapTo(st.st_size);
+    scanFrom(0);
+}
+
+void PasswdMgr::closeFile() {
+    if (this->base != nullptr)
+    {
+        munmap(this->base, this->mappedBytes);
+        this->base = nullptr;
+        this->mappedBytes = 0;
+    }
+    if (this->fd >= 0)
+    {
+        close(this->fd);
+        this->fd = -1;
+    }
+}
+
+//makes sure the mapping covers bytes of the file, growing it by doubling so appends rarely remap
+void PasswdMgr::mapTo(size_t bytes) {
+    if (bytes <= this->mappedBytes)
+    {
+        return;
+    }
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = std::max(bytes, this->mappedBytes * 2);
+    size = std::max(size, static_cast<size_t>(65536));
+    size = (size + page - 1) & ~(page - 1);
+
+    //only the part backed by the file is ever touched, the rest is room to grow into
+    void *mapped;
+    if (this->base == nullptr)
+    {
+        mapped = mmap(NULL, size, PROT_READ, MAP_SHARED, this->fd, 0);
+    }
+    else
+    {
+        mapped = mremap(this->base, this->mappedBytes, size, MREMAP_MAYMOVE);
+    }
+    if (mapped == MAP_FAILED)
+    {
+        throw std::runtime_error("Unable to map password file " + this->path);
+    }
+    this->base = static_cast<char *>(mapped);
+    this->mappedBytes = size;
+}
+
+/**********************************************************************************************
+ * scanFrom - Indexes the records from the given one up to the end of the file. Stops at the
+ *            first record that is incomplete or fails its checksum, which can only be the
+ *            tail of an append that never finished.
+ *
+ **********************************************************************************************/
+
+void PasswdMgr::scanFrom(size_t record) {
+    const passwd_record *records = reinterpret_cast<const passwd_record *>(this->base + sizeof(passwd_header));
+    size_t available = (static_cast<size_t>(this->fileBytes) - sizeof(passwd_header)) / sizeof(passwd_record);
+    while (record < available)
+    {
+        const passwd_record &entry = records[record];
+        if ((entry.checksum != recordChecksum(entry)) || !validName(entry.name, entry.nameLen))
+        {
+            break;
+        }
+        indexRecord(record);
+        record++;
+    }
+    this->recordCount = record;
+}
+
+/**********************************************************************************************
+ * refresh - Catches up with changes made through another PasswdMgr: a replaced file (another
+ *           process compacted) is reopened, a longer one has its new records indexed.
+ *           Needs writeLock, takes the exclusive lock only to change the mapping and index.
+ *
+ **********************************************************************************************/
+
+void PasswdMgr::refresh() {
+    struct stat st;
+    if ((stat(this->path.c_str(), &st) == 0) && (st.st_ino != this->inode))
+    {
+        reopen();
+        return;
+    }
+    //compared with the last valid record, not the old size, so a tail seen half written is looked at again
+    off_t validEnd = sizeof(passwd_header) + static_cast<off_t>(this->recordCount) * sizeof(passwd_record);
+    if (fstat(this->fd, &st) == 0)
+    {
+        this->fileBytes = st.st_size;
+        if (st.st_size >= validEnd + static_cast<off_t>(sizeof(passwd_record)))
+        {
+            std::unique_lock<std::shared_mutex> guard(this->lock);
+            mapTo(st.st_size);
+            scanFrom(this->recordCount);
+        }
+    }
+}
+
+//takes the file lock for an append or compaction, on the file currently at path, and catches up.
+//Needs writeLock, lookups carry on while this waits for another process
+void PasswdMgr::lockForWrite() {
+    while (true)
+    {
+        if (flock(this->fd, LOCK_EX) < 0)
+        {
+            throw std::runtime_error("Unable to lock password file " + this->path);
+        }
+        struct stat st;
+        if ((stat(this->path.c_str(), &st) == 0) && (st.st_ino == this->inode))
+        {
+            break;
+        }
+        //compacted away while waiting, the lock has to be on the file that replaced it
+        flock(this->fd, LOCK_UN);
+        reopen();
+    }
+    refresh();
+}
+
+/**********************************************************************************************
+ * reopen - Switches to the file now at path. It is opened, checked and indexed by a separate
+ *          PasswdMgr without any lock held, and only swapped in once that succeeded, so a
+ *          file that can not be opened or is not a store leaves the current one in use.
+ *          The old mapping is released after the exclusive lock. Needs writeLock.
+ *
+ *    Throws: runtime_error if the new file can not be opened or mapped, or is not a store
+ **********************************************************************************************/
+
+void PasswdMgr::reopen() {
+    PasswdMgr fresh(this->path.c_str());
+    std::unique_lock<std::shared_mutex> guard(this->lock);
+    std::swap(this->fd, fresh.fd);
+    std::swap(this->base, fresh.base);
+    std::swap(this->mappedBytes, fresh.mappedBytes);
+    std::swap(this->recordCount, fresh.recordCount);
+    std::swap(this->inode, fresh.inode);
+    std::swap(this->fileBytes, fresh.fileBytes);
+    std::swap(this->index, fresh.index);
+    std::swap(this->live, fresh.live);
+}
+
+/**********************************************************************************************
+ * rewrite - Compaction: writes the header and the newest record of every user to a temporary
+ *           file, syncs it and renames it over the store, then opens the new file. Called
+ *           with writeLock and the file lock held, the file lock goes with the old file
+ *           (or is released here if the new one can not be opened).
+ *           Lookups only wait for the reopen at the end.
+ *
+ *    Throws: runtime_error if the new file can not be written
+ **********************************************************************************************/
+
+void PasswdMgr::rewrite() {
+    std::string tempPath = this->path + ".tmp";
+    std::vector<char> contents(sizeof(passwd_header));
+    memcpy(contents.data(), this->base, sizeof(passwd_header));
+
+    //a record is live if the index resolves its name to it, kept in file order
+    const passwd_record *records = reinterpret_cast<const passwd_record *>(this->base + sizeof(passwd_header));
+    for (size_t i = 0; i < this->recordCount; i++)
+    {
+        if (find(records[i].name, records[i].nameLen) == &records[i])
+        {
+            const char *bytes = reinterpret_cast<const char *>(&records[i]);
+            contents.insert(contents.end(), bytes, bytes + sizeof(passwd_record));
+        }
+    }
+
+    int tempFD = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (tempFD < 0)
+    {
+        throw std::runtime_error("Unable to create " + tempPath + ": " + strerror(errno));
+    }
+    bool written = (write(tempFD, contents.data(), contents.size()) == static_cast<ssize_t>(contents.size())) && (fsync(tempFD) == 0);
+    close(tempFD);
+    if (!written || (rename(tempPath.c_str(), this->path.c_str()) < 0))
+    {
+        unlink(tempPath.c_str());
+        throw std::runtime_error("Unable to compact password file " + this->path);
+    }
+
+    //the rename itself is only durable once the directory is synced
+    size_t slash = this->path.rfind('/');
+    std::string dir = (slash == std::string::npos) ? "." : this->path.substr(0, slash + 1);
+    int dirFD = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFD >= 0)
+    {
+        fsync(dirFD);
+        close(dirFD);
+    }
+
+    //the old file and its lock stay ours until the new one is in use
+    try {
+        reopen();
+    } catch (std::runtime_error &) {
+        flock(this->fd, LOCK_UN);
+        throw;
+    }
+}
+
+/**********************************************************************************************
+ * appendRecord - Hashes the password (without holding any lock, it is the slow part) and
+ *                appends and syncs the record under the file lock; lookups are only held up
+ *                while the new record is mapped and indexed. A torn tail left by a crash is cut
+ *                off first so records stay aligned. Compacts once enough records are dead.
+ *                Returns false if the user's existence is not what mustExist asks for.
+ *
+ *    Throws: runtime_error if the record can not be written and synced
+ **********************************************************************************************/
+
+bool PasswdMgr::appendRecord(const char *name, const char *passwd, bool mustExist) {
+    size_t nameLen = strlen(name);
+    {
+        std::shared_lock<std::shared_mutex> guard(this->lock);
+        if ((find(name, nameLen) != nullptr) != mustExist)
+        {
+            return false;
+        }
+    }
+
+    passwd_record record;
+    memset(&record, 0, sizeof(record));
+    record.algorithm = defaultAlgorithm();
+    record.nameLen = static_cast<uint8_t>(nameLen);
+    record.cost = (record.algorithm == PWD_ALG_ARGON2ID) ? ARGON2_PASSES : PBKDF2_ITERATIONS;
+    record.memoryKiB = (record.algorithm == PWD_ALG_ARGON2ID) ? ARGON2_MEMORY_KIB : 0;
+    memcpy(record.name, name, nameLen);
+    if (getrandom(record.salt, sizeof(record.salt), 0) != sizeof(record.salt))
+    {
+        throw std::runtime_error("Unable to get random bytes for a salt");
+    }
+    hashPassword(record, passwd, record.hash);
+    record.checksum = recordChecksum(record);
+
+    //writers in this process own the file state, so the mapping can be read without the shared lock
+    std::lock_guard<std::mutex> writer(this->writeLock);
+    lockForWrite();
+    if ((find(name, nameLen) != nullptr) != mustExist)
+    {
+        flock(this->fd, LOCK_UN);
+        return false;
+    }
+
+    off_t end = sizeof(passwd_header) + static_cast<off_t>(this->recordCount) * sizeof(passwd_record);
+    if ((this->fileBytes != end) && (ftruncate(this->fd, end) < 0))
+    {
+        flock(this->fd, LOCK_UN);
+        throw std::runtime_error("Unable to repair password file " + this->path);
+    }
+    if ((pwrite(this->fd, &record, sizeof(record), end) != sizeof(record)) || (fdatasync(this->fd) < 0))
+    {
+        flock(this->fd, LOCK_UN);
+        throw std::runtime_error("Unable to write password file " + this->path);
+    }
+    this->fileBytes = end + sizeof(record);
+    {
+        std::unique_lock<std::shared_mutex> guard(this->lock);
+        mapTo(this->fileBytes);
+        indexRecord(this->recordCount);
+        this->recordCount++;
+    }
+
+    size_t dead = this->recordCount - this->live;
+    if ((dead >= COMPACT_MIN_SUPERSEDED) && (dead > this->live))
+    {
+        rewrite();
+    }
+    else
+    {
+        flock(this->fd, LOCK_UN);
+    }
+    return true;
+}
+
+bool PasswdMgr::checkUser(const char *name) {
+    size_t nameLen = strlen(name);
+    if (!validName(name, nameLen))
+    {
+        return false;
+    }
+    {
+        std::shared_lock<std::shared_mutex> guard(this->lock);
+        if (find(name, nameLen) != nullptr)
+        {
+            return true;
+        }
+    }
+
+    //may have been added by another process since the last look
+    std::lock_guard<std::mutex> writer(this->writeLock);
+    refresh();
+    std::shared_lock<std::shared_mutex> guard(this->lock);
+    return find(name, nameLen) != nullptr;
+}
+
+bool PasswdMgr::knownUser(const char *name) {
+    size_t nameLen = strlen(name);
+    if (!validName(name, nameLen))
+    {
+        return false;
+    }
+    std::shared_lock<std::shared_mutex> guard(this->lock);
+    return find(name, nameLen) != nullptr;
+}
+
+/**********************************************************************************************
+ * checkPasswd - Hashes the password with the salt and parameters of the user's newest record
+ *               and compares in constant time. The record is copied out so the hash runs
+ *               without holding the lock.
+ *
+ *    Throws: runtime_error if the record's algorithm is not available in this build
+ **********************************************************************************************/
+
+bool PasswdMgr::checkPasswd(const char *name, const char *passwd) {
+    if (!checkUser(name))
+    {
+        return false;
+    }
+
+    passwd_record record;
+    {
+        std::shared_lock<std::shared_mutex> guard(this->lock);
+        const passwd_record *found = find(name, strlen(name));
+        if (found == nullptr)
+        {
+            return false;
+        }
+        record = *found;
+    }
+
+    uint8_t hash[PASSWD_HASH_LEN];
+    hashPassword(record, passwd, hash);
+    return sameHash(hash, record.hash);
+}
+
+bool PasswdMgr::changePasswd(const char *name, const char *newpassword) {
+    if (!checkUser(name))
+    {
+        return false;
+    }
+    return appendRecord(name, newpassword, true);
+}
+
+bool PasswdMgr::addUser(const char *name, const char *passwd) {
+    if (!validName(name, strlen(name)))
+    {
+        throw std::invalid_argument("User names are 1 to 48 printable characters without spaces");
+    }
+    if (checkUser(name))
+    {
+        return false;
+    }
+    return appendRecord(name, passwd, false);
+}
+
+void PasswdMgr::compact() {
+    std::lock_guard<std::mutex> writer(this->writeLock);
+    lockForWrite();
+    rewrite();
+}
+
+size_t PasswdMgr::users() {
+    std::shared_lock<std::shared_mutex> guard(this->lock);
+    return this->live;
+}
+
+size_t PasswdMgr::superseded() {
+    std::shared_lock<std::shared_mutex> guard(this->lock);
+    return this->recordCount - this->live;
+}
+
+//newest record of the name, probing from its hash until an empty slot
+const passwd_record *PasswdMgr::find(const char *name, size_t nameLen) const {
+    const passwd_record *records = reinterpret_cast<const passwd_record *>(this->base + sizeof(passwd_header));
+    uint32_t hash = fnv1a(name, nameLen);
+    size_t mask = this->index.size() - 1;
+    for (size_t i = hash & mask; this->index[i].record != 0; i = (i + 1) & mask)
+    {
+        const index_slot &slot = this->index[i];
+        if (slot.hash == hash)
+        {
+            const passwd_record *record = &records[slot.record - 1];
+            if ((record->nameLen == nameLen) && (memcmp(record->name, name, nameLen) == 0))
+            {
+                return record;
+            }
+        }
+    }
+    return nullptr;
+}
+
+//points the record's name at it, replacing an older record of the same name
+void PasswdMgr::indexRecord(uint32_t record) {
+    if ((this->live + 1) * 2 > this->index.size())
+    {
+        growIndex();
+    }
+
+    const passwd_record *records = reinterpret_cast<const passwd_record *>(this->base + sizeof(passwd_header));
+    const passwd_record &entry = records[record];
+    uint32_t hash = fnv1a(entry.name, entry.nameLen);
+    size_t mask = this->index.size() - 1;
+    size_t i = hash & mask;
+    for (; this->index[i].record != 0; i = (i + 1) & mask)
+    {
+        const index_slot &slot = this->index[i];
+        const passwd_record &other = records[slot.record - 1];
+        if ((slot.hash == hash) && (other.nameLen == entry.nameLen) && (memcmp(other.name, entry.name, entry.nameLen) == 0))
+        {
+            this->index[i].record = record + 1;
+            return;
+        }
+    }
+    this->index[i] = index_slot{hash, record + 1};
+    this->live++;
+}
+
+//doubles the table and reinserts every entry, keeping the load at or under one half
+void PasswdMgr::growIndex() {
+    std::vector<index_slot> old;
+    old.swap(this->index);
+    this->index.assign(old.size() * 2, index_slot{0, 0});
+    size_t mask = this->index.size() - 1;
+    for (const index_slot &slot : old)
+    {
+        if (slot.record == 0)
+        {
+            continue;
+        }
+        size_t i = slot.hash & mask;
+        while (this->index[i].record != 0)
+        {
+            i = (i + 1) & mask;
+        }
+        this->index[i] = slot;
+    }
+}
+
+/**********************************************************************************************
+ * hashPassword - Derives PASSWD_HASH_LEN bytes from the password with the algorithm, cost and
+ *                salt given in params.
+ *
+ *    Throws: runtime_error if the algorithm is not built in or the hash fails
+ **********************************************************************************************/
+
+void PasswdMgr::hashPassword(const passwd_record &params, const char *passwd, uint8_t *hash) {
+    size_t passwdLen = strlen(passwd);
+    if (params.algorithm == PWD_ALG_ARGON2ID)
+    {
+#ifdef HAVE_ARGON2
+        if (argon2id_hash_raw(params.cost, params.memoryKiB, 1, passwd, passwdLen, params.salt, PASSWD_SALT_LEN,
+                              hash, PASSWD_HASH_LEN) == ARGON2_OK)
+        {
+            return;
+        }
+        throw std::runtime_error("Argon2 hashing failed");
+#endif
+    }
+    else if (params.algorithm == PWD_ALG_PBKDF2_SHA256)
+    {
+#ifdef HAVE_LIBCRYPTO
+        if (PKCS5_PBKDF2_HMAC(passwd, passwdLen, params.salt, PASSWD_SALT_LEN, params.cost, EVP_sha256(),
+                              PASSWD_HASH_LEN, hash) == 1)
+        {
+            return;
+        }
+        throw std::runtime_error("PBKDF2 hashing failed");
+#endif
+    }
+    (void)passwdLen;
+    throw std::runtime_error("Password hash algorithm " + std::to_string(params.algorithm) + " is not built in");
+}
+
+//names go on the wire and into logs, so no spaces or control characters
+bool PasswdMgr::validName(const char *name, size_t nameLen) {
+    if ((nameLen == 0) || (nameLen > PASSWD_MAX_NAME))
+    {
+        return false;
+    }
+    for (size_t i = 0; i < nameLen; i++)
+    {
+        unsigned char c = static_cast<unsigned char>(name[i]);
+        if ((c <= ' ') || (c == 0x7f))
+        {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,151 @@
+#include "ResponseStore.h"
+#include "Logger.h"
+
+#include <fstream>
+#include <map>
+#include <stdexcept>
+
+std::atomic<bool> ResponseStore::reloadRequested{false};
+
+//appended to every reply so the client knows it can type again
+static const char prompt[] = "\n\nCOMMAND:";
+
+//section texts used when no file is given or a file leaves one out
+static std::map<std::string, std::string> defaultSections() {
+    std::map<std::string, std::string> sections;
+    sections["greeting"] = "Hello Client!";
+    sections["menu"] = "COMMAND MENU\nhello: Welcome message\n1: Current IP Address\n2: Current Port\n3: Displays Graphic\n4: Displays Graphic\n5: Displays Graphic\npasswd: Change Password\nstats: Server Statistics\nexit: Disconnect From Server\nmenu: Displays Menu";
+    sections["hello"] = "(>n_n)> Hello Client";
+    sections["passwd"] = "Password changes are not enabled on this server";
+    sections["graphic3"] = "__m_OO_m__";
+    sections["graphic4"] = "m_(-___-)_m";
+    sections["graphic5"] = "d[ o_O ]b";
+    return sections;
+}
+
+//serializes every reply once, exactly as it goes on the wire
+static std::shared_ptr<const ResponseSet> buildSet(std::map<std::string, std::string> &sections) {
+    std::shared_ptr<ResponseSet> replies = std::make_shared<ResponseSet>();
+    replies->payloads[RESP_WELCOME] = std::make_shared<const std::string>(sections["greeting"] + "\n\n" + sections["menu"] + prompt);
+    replies->payloads[RESP_MENU] = std::make_shared<const std::string>(sections["menu"] + prompt);
+    replies->payloads[RESP_HELLO] = std::make_shared<const std::string>(sections["hello"] + prompt);
+    replies->payloads[RESP_PASSWD] = std::make_shared<const std::string>(sections["passwd"] + prompt);
+    replies->payloads[RESP_GRAPHIC1] = std::make_shared<const std::string>(sections["graphic3"] + prompt);
+    replies->payloads[RESP_GRAPHIC2] = std::make_shared<const std::string>(sections["graphic4"] + prompt);
+    replies->payloads[RESP_GRAPHIC3] = std::make_shared<const std::string>(sections["graphic5"] + prompt);
+    //without the blank line, which stays on the reply it follows
+    replies->payloads[RESP_PROMPT] = std::make_shared<const std::string>(prompt + 2);
+    return replies;
+}
+
+ResponseStore::ResponseStore() {
+    std::map<std::string, std::string> sections = defaultSections();
+    publish(buildSet(sections));
+}
+
+ResponseStore &ResponseStore::instance() {
+    static ResponseStore store;
+    return store;
+}
+
+std::shared_ptr<const ResponseSet> ResponseStore::snapshot() const {
+    return std::atomic_load(&this->current);
+}
+
+//swaps in a new set, loops pick it up the next time they compare versions
+void ResponseStore::publish(std::shared_ptr<const ResponseSet> replies) {
+    std::atomic_store(&this->current, replies);
+    this->currentVersion.fetch_add(1, std::memory_order_release);
+}
+
+/**********************************************************************************************
+ * loadFile - Parses a response file on top of the defaults and publishes the result.
+ *
+ *    Throws: runtime_error if the file can not be opened
+ **********************************************************************************************/
+
+void ResponseStore::loadFile(const std::string &path) {
+    std::lock_guard<std::mutex> guard(this->loadLock);
+
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Unable to open response file " + path);
+    }
+
+    std::map<std::string, std::string> sections = defaultSections();
+    std::map<std::string, std::string> found;
+    std::string line;
+    std::string section;
+    while (std::getline(file, line))
+    {
+        if (!line.empty() && (line.back() == '\r'))
+        {
+            line.pop_back();
+        }
+        if (!line.empty() && (line[0] == '#'))
+        {
+            continue;
+        }
+        if ((line.size() > 2) && (line.front() == '[') && (line.back() == ']'))
+        {
+            section = line.substr(1, line.size() - 2);
+            found[section].clear();
+            continue;
+        }
+        if (section.empty())
+        {
+            continue;
+        }
+        std::string &text = found[section];
+        if (!text.empty())
+        {
+            text += '\n';
+        }
+        text += line;
+    }
+
+    for (std::pair<const std::string, std::string> &entry : found)
+    {
+        if (sections.count(entry.first) == 0)
+        {
+            LOG_WARN("Ignoring unknown response section [%s]", entry.first.c_str());
+            continue;
+        }
+        sections[entry.first] = entry.second;
+    }
+
+    publish(buildSet(sections));
+    this->sourcePath = path;
+}
+
+//re-reads the last file, the current replies stay in place if it fails
+bool ResponseStore::reload() {
+    std::string path;
+    {
+        std::lock_guard<std::mutex> guard(this->loadLock);
+        path = this->sourcePath;
+    }
+    if (path.empty())
+    {
+        return false;
+    }
+    try {
+        loadFile(path);
+    } catch (std::runtime_error &e) {
+        LOG_ERROR("Response reload failed: %s", e.what());
+        return false;
+    }
+    LOG_INFO("Responses reloaded from %s", path.c_str());
+    return true;
+}
+
+//only touches a lock-free atomic, safe to call from a signal handler
+void ResponseStore::requestReload() {
+    reloadRequested.store(true, std::memory_order_relaxed);
+}
+
+//true for exactly one caller per request
+bool ResponseStore::takeReloadRequest() {
+    return reloadRequested.load(std::memory_order_relaxed) && reloadRequested.exchange(false);
+}
@@ -0,0 +1,182 @@
+#include "config.h"
+#include "SessionTickets.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <string.h>
+#include <sys/random.h>
+
+#ifdef HAVE_LIBCRYPTO
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#endif
+
+static const char hex_digits[] = "0123456789abcdef";
+
+//value of one hex digit, -1 if c is not one
+static int hexValue(char c) {
+    if ((c >= '0') && (c <= '9'))
+        return c - '0';
+    if ((c >= 'a') && (c <= 'f'))
+        return c - 'a' + 10;
+    return -1;
+}
+
+SessionTickets::SessionTickets() {
+    memset(this->key, 0, sizeof(this->key));
+}
+
+SessionTickets &SessionTickets::instance() {
+    static SessionTickets tickets;
+    return tickets;
+}
+
+/**********************************************************************************************
+ * enable - Draws the key tickets are signed with and turns tickets on. A lifetime of 0 leaves
+ *          them off.
+ *
+ *    Throws: runtime_error if this build has no HMAC or the key can not be drawn
+ **********************************************************************************************/
+
+void SessionTickets::enable(unsigned int lifetimeSecs, size_t capacity) {
+    if (lifetimeSecs == 0)
+    {
+        return;
+    }
+#ifndef HAVE_LIBCRYPTO
+    throw std::runtime_error("Session tickets need libcrypto, which this build was made without");
+#endif
+    if (getrandom(this->key, sizeof(this->key), 0) != sizeof(this->key))
+    {
+        throw std::runtime_error("Unable to get random bytes for the session ticket key");
+    }
+    this->capacity = std::max<size_t>(capacity, 1);
+    this->lifetimeMs = static_cast<int64_t>(lifetimeSecs) * 1000;
+}
+
+//first TICKET_TAG_LEN bytes of the HMAC-SHA256 of the ticket number
+void SessionTickets::sign(uint64_t number, uint8_t *tag) const {
+#ifdef HAVE_LIBCRYPTO
+    uint8_t digest[EVP_MAX_MD_SIZE];
+    unsigned int digestLen = 0;
+    HMAC(EVP_sha256(), this->key, sizeof(this->key), reinterpret_cast<const uint8_t *>(&number), sizeof(number),
+         digest, &digestLen);
+    memcpy(tag, digest, TICKET_TAG_LEN);
+#else
+    (void)number;
+    memset(tag, 0, TICKET_TAG_LEN);
+#endif
+}
+
+uint32_t SessionTickets::generationOf(const std::string &user) const {
+    std::unordered_map<std::string, uint32_t>::const_iterator found = this->generations.find(user);
+    return (found != this->generations.end()) ? found->second : 0;
+}
+
+/**********************************************************************************************
+ * issue - Records a ticket for user and returns its text, or an empty string when tickets are
+ *         off. The oldest ticket is dropped if the store is full.
+ *
+ **********************************************************************************************/
+
+std::string SessionTickets::issue(std::string_view user, int64_t nowMs) {
+    if (!enabled())
+    {
+        return std::string();
+    }
+
+    uint64_t number;
+    {
+        std::lock_guard<std::mutex> guard(this->ticketLock);
+        number = this->nextNumber++;
+        if (this->recent.size() >= this->capacity)
+        {
+            this->byNumber.erase(this->recent.back().number);
+            this->recent.pop_back();
+        }
+        std::string name(user);
+        uint32_t generation = generationOf(name);
+        this->recent.push_front(ticket_entry{number, nowMs + this->lifetimeMs, generation, std::move(name)});
+        this->byNumber[number] = this->recent.begin();
+    }
+
+    uint8_t raw[8 + TICKET_TAG_LEN];
+    memcpy(raw, &number, 8);
+    sign(number, raw + 8);
+
+    std::string text(TICKET_TEXT_LEN, '0');
+    for (size_t i = 0; i < sizeof(raw); i++)
+    {
+        text[2 * i] = hex_digits[raw[i] >> 4];
+        text[2 * i + 1] = hex_digits[raw[i] & 0x0f];
+    }
+    return text;
+}
+
+/**********************************************************************************************
+ * redeem - Checks a ticket and uses it up. On success user is set to whom it was issued to.
+ *          Forged or mistyped tickets fail on the tag before anything shared is touched.
+ *
+ **********************************************************************************************/
+
+bool SessionTickets::redeem(std::string_view ticket, int64_t nowMs, std::string &user) {
+    if (!enabled() || (ticket.size() != TICKET_TEXT_LEN))
+    {
+        return false;
+    }
+
+    uint8_t raw[8 + TICKET_TAG_LEN];
+    for (size_t i = 0; i < sizeof(raw); i++)
+    {
+        int high = hexValue(ticket[2 * i]);
+        int low = hexValue(ticket[2 * i + 1]);
+        if ((high < 0) || (low < 0))
+        {
+            return false;
+        }
+        raw[i] = static_cast<uint8_t>((high << 4) | low);
+    }
+
+    uint64_t number;
+    memcpy(&number, raw, 8);
+    uint8_t tag[TICKET_TAG_LEN];
+    sign(number, tag);
+#ifdef HAVE_LIBCRYPTO
+    if (CRYPTO_memcmp(tag, raw + 8, TICKET_TAG_LEN) != 0)
+    {
+        return false;
+    }
+#endif
+
+    std::lock_guard<std::mutex> guard(this->ticketLock);
+    std::unordered_map<uint64_t, std::list<ticket_entry>::iterator>::iterator found = this->byNumber.find(number);
+    if (found == this->byNumber.end())
+    {
+        return false;
+    }
+    std::list<ticket_entry>::iterator entry = found->second;
+    bool valid = (entry->expiresMs > nowMs) && (entry->generation == generationOf(entry->user));
+    if (valid)
+    {
+        user = std::move(entry->user);
+    }
+    this->recent.erase(entry);
+    this->byNumber.erase(found);
+    return valid;
+}
+
+/**********************************************************************************************
+ * revoke - Moves user on to a new generation, the tickets it already has stop working. They
+ *          stay in the store until redeemed or pushed out, which then fails.
+ *
+ **********************************************************************************************/
+
+void SessionTickets::revoke(std::string_view user) {
+    if (!enabled())
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(this->ticketLock);
+    this->generations[std::string(user)]++;
+}
@@ -0,0 +1,494 @@
+#include "TCPBench.h"
+
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+//networking headers
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "exceptions.h"
+#include "Metrics.h"
+
+//every reply ends with this, see ResponseStore
+static const char prompt[] = "COMMAND:";
+#define PROMPT_LENGTH 8
+
+//how long in-flight commands may take to finish once the run is over
+#define DRAIN_NS 2000000000LL
+
+static int64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+TCPBench::TCPBench() {
+    setMix("hello:1,1:1,2:1,3:1,4:1,5:1,menu:1,bogus:1");
+}
+
+TCPBench::~TCPBench() {
+    for (bench_worker &worker : this->workers)
+    {
+        for (bench_conn &conn : worker.conns)
+        {
+            if (conn.fd >= 0)
+            {
+                close(conn.fd);
+            }
+        }
+    }
+}
+
+void TCPBench::setTarget(const std::string &ip, unsigned short port) {
+    this->ip = ip;
+    this->port = port;
+}
+
+void TCPBench::setConnections(unsigned int connections) {
+    this->connections = (connections < 1) ? 1 : connections;
+}
+
+void TCPBench::setDuration(unsigned int seconds) {
+    this->durationSecs = (seconds < 1) ? 1 : seconds;
+}
+
+void TCPBench::setRate(uint64_t perSecond) {
+    this->rate = perSecond;
+}
+
+void TCPBench::setPipeline(unsigned int depth) {
+    this->pipeline = (depth < 1) ? 1 : depth;
+}
+
+void TCPBench::setThreads(unsigned int threads) {
+    this->threadCount = (threads < 1) ? 1 : threads;
+}
+
+/**********************************************************************************************
+ * setMix - Parses "cmd:weight,..." into the command rotation, each command repeated weight
+ *          times. A missing weight means 1.
+ *
+ *    Throws: invalid_argument if an entry is empty or has a weight outside 1..1000
+ **********************************************************************************************/
+
+void TCPBench::setMix(const std::string &spec) {
+    std::vector<std::string> parsed;
+    size_t start = 0;
+    while (start <= spec.size())
+    {
+        size_t comma = spec.find(',', start);
+        std::string entry = spec.substr(start, (comma == std::string::npos) ? std::string::npos : comma - start);
+        size_t colon = entry.find(':');
+        std::string command = entry.substr(0, colon);
+        long weight = 1;
+        if (colon != std::string::npos)
+        {
+            weight = strtol(entry.c_str() + colon + 1, NULL, 10);
+        }
+        if (command.empty() || (weight < 1) || (weight > 1000))
+        {
+            throw std::invalid_argument("Invalid command mix entry '" + entry + "'");
+        }
+        for (long i = 0; i < weight; i++)
+        {
+            parsed.push_back(command + "\n");
+        }
+        if (comma == std::string::npos)
+        {
+            break;
+        }
+        start = comma + 1;
+    }
+    this->mix.swap(parsed);
+}
+
+/**********************************************************************************************
+ * connectAll - Opens every connection up front (blocking connect, then non-blocking for the
+ *              run) and deals them out to the workers.
+ *
+ *    Throws: socket_error if a connection fails
+ **********************************************************************************************/
+
+void TCPBench::connectAll() {
+    struct rlimit fdLimit;
+    if ((getrlimit(RLIMIT_NOFILE, &fdLimit) == 0) && (fdLimit.rlim_cur < fdLimit.rlim_max))
+    {
+        fdLimit.rlim_cur = fdLimit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &fdLimit);
+    }
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = inet_addr(this->ip.c_str());
+    address.sin_port = htons(this->port);
+
+    this->workers.assign(this->threadCount, bench_worker());
+    for (unsigned int i = 0; i < this->connections; i++)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+        {
+            throw socket_error("Bench socket failed");
+        }
+        if (connect(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) < 0)
+        {
+            close(fd);
+            throw socket_error("Bench connect failed after " + std::to_string(i) + " connections: " + strerror(errno));
+        }
+        int optVal = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optVal, sizeof(optVal));
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+
+        bench_worker &worker = this->workers[i % this->threadCount];
+        if (static_cast<size_t>(fd) >= worker.fdToConn.size())
+        {
+            worker.fdToConn.resize(fd + 1, -1);
+        }
+        worker.fdToConn[fd] = static_cast<int>(worker.conns.size());
+        bench_conn conn;
+        conn.fd = fd;
+        conn.inflight.assign(this->pipeline, 0);
+        conn.mixPos = i;
+        worker.conns.push_back(std::move(conn));
+    }
+}
+
+/**********************************************************************************************
+ * run - Connects, runs every worker for the duration (plus a short drain for replies still in
+ *       flight) and merges their results.
+ *
+ *    Throws: socket_error if connecting fails
+ **********************************************************************************************/
+
+void TCPBench::run() {
+    connectAll();
+
+    this->startNs = nowNs();
+    this->endNs = this->startNs + static_cast<int64_t>(this->durationSecs) * 1000000000LL;
+
+    //staggers the fixed rate schedules so the connections do not all fire together
+    if (this->rate > 0)
+    {
+        int64_t intervalNs = static_cast<int64_t>((1000000000.0 * this->connections) / this->rate);
+        unsigned int index = 0;
+        for (bench_worker &worker : this->workers)
+        {
+            for (bench_conn &conn : worker.conns)
+            {
+                conn.nextDueNs = this->startNs + (intervalNs * index) / this->connections;
+                index++;
+            }
+        }
+    }
+
+    std::vector<std::thread> threads;
+    for (bench_worker &worker : this->workers)
+    {
+        threads.emplace_back(&TCPBench::runWorker, this, std::ref(worker));
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    this->histogram.assign(METRIC_BUCKETS, 0);
+    for (bench_worker &worker : this->workers)
+    {
+        for (unsigned int b = 0; b < METRIC_BUCKETS; b++)
+        {
+            this->histogram[b] += worker.histogram[b];
+        }
+        this->completed += worker.completed;
+        this->sent += worker.sent;
+        this->errors += worker.errors;
+        this->timedOut += worker.timedOut;
+        this->unsent += worker.unsent;
+        this->maxNs = std::max(this->maxNs, worker.maxNs);
+    }
+}
+
+//one worker thread: its own epoll loop over its share of the connections
+void TCPBench::runWorker(bench_worker &worker) {
+    worker.histogram.assign(METRIC_BUCKETS, 0);
+    EventLoop loop(1024);
+    for (bench_conn &conn : worker.conns)
+    {
+        loop.add(conn.fd, EPOLLIN | EPOLLRDHUP);
+    }
+
+    bool draining = false;
+    while (true)
+    {
+        int64_t now = nowNs();
+        if (!draining && (now >= this->endNs))
+        {
+            draining = true;
+        }
+
+        //fixed rate: sends whatever came due and finds the next deadline to sleep until
+        int timeoutMs = 100;
+        size_t outstanding = 0;
+        int64_t nextDue = INT64_MAX;
+        for (bench_conn &conn : worker.conns)
+        {
+            if (conn.fd < 0)
+            {
+                continue;
+            }
+            outstanding += conn.inflightCount;
+            if (draining || !conn.ready)
+            {
+                continue;
+            }
+            sendDue(worker, conn, now);
+            if ((this->rate > 0) && (conn.inflightCount < this->pipeline))
+            {
+                nextDue = std::min(nextDue, conn.nextDueNs);
+            }
+        }
+        if (draining && ((outstanding == 0) || (now >= this->endNs + DRAIN_NS)))
+        {
+            recordUnanswered(worker, now);
+            return;
+        }
+        if (nextDue != INT64_MAX)
+        {
+            int64_t waitNs = nextDue - nowNs();
+            timeoutMs = (waitNs <= 0) ? 0 : static_cast<int>(std::min<int64_t>((waitNs + 999999) / 1000000, 100));
+        }
+
+        int ready = loop.wait(timeoutMs);
+        now = nowNs();
+        for (int i = 0; i < ready; i++)
+        {
+            const struct epoll_event &ev = loop.event(i);
+            bench_conn &conn = worker.conns[worker.fdToConn[ev.data.fd]];
+            if (conn.fd < 0)
+            {
+                continue;
+            }
+            if (!readReplies(worker, conn, now))
+            {
+                worker.errors++;
+                loop.remove(conn.fd);
+                close(conn.fd);
+                conn.fd = -1;
+                conn.inflightCount = 0;
+                continue;
+            }
+            //closed loop: a reply frees a slot, refill it right away
+            if (!draining && conn.ready && (this->rate == 0))
+            {
+                sendDue(worker, conn, now);
+            }
+        }
+    }
+}
+
+/**********************************************************************************************
+ * sendDue - Queues the commands a connection may send now and writes them in one call: up
+ *           to the pipeline depth in closed loop, only those whose intended time has come at
+ *           a fixed rate.
+ *
+ **********************************************************************************************/
+
+void TCPBench::sendDue(bench_worker &worker, bench_conn &conn, int64_t now) {
+    while (conn.inflightCount < this->pipeline)
+    {
+        int64_t stamp = now;
+        if (this->rate > 0)
+        {
+            if (conn.nextDueNs > now)
+            {
+                break;
+            }
+            stamp = conn.nextDueNs;
+            conn.nextDueNs += static_cast<int64_t>((1000000000.0 * this->connections) / this->rate);
+        }
+        conn.pendingOut.append(this->mix[conn.mixPos % this->mix.size()]);
+        conn.mixPos++;
+        conn.inflight[(conn.inflightHead + conn.inflightCount) % this->pipeline] = stamp;
+        conn.inflightCount++;
+        worker.sent++;
+    }
+
+    if (conn.pendingOut.empty())
+    {
+        return;
+    }
+    ssize_t written = send(conn.fd, conn.pendingOut.data(), conn.pendingOut.size(), MSG_NOSIGNAL);
+    if (written > 0)
+    {
+        conn.pendingOut.erase(0, written);
+    }
+}
+
+/**********************************************************************************************
+ * readReplies - Reads everything available and counts prompts. The first prompt is the
+ *               greeting; every later one completes the oldest command in flight. Returns
+ *               false if the server closed the connection or it failed.
+ *
+ **********************************************************************************************/
+
+bool TCPBench::readReplies(bench_worker &worker, bench_conn &conn, int64_t now) {
+    char buffer[65536];
+    while (true)
+    {
+        ssize_t got = recv(conn.fd, buffer, sizeof(buffer), 0);
+        if (got < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+        }
+        if (got == 0)
+        {
+            return false;
+        }
+
+        //the prompt has no repeated prefix, so a mismatch only has to check for a new 'C'
+        for (ssize_t i = 0; i < got; i++)
+        {
+            char c = buffer[i];
+            if (c == prompt[conn.promptMatched])
+            {
+                conn.promptMatched++;
+            }
+            else
+            {
+                conn.promptMatched = (c == prompt[0]) ? 1 : 0;
+            }
+            if (conn.promptMatched < PROMPT_LENGTH)
+            {
+                continue;
+            }
+            conn.promptMatched = 0;
+
+            if (!conn.ready)
+            {
+                conn.ready = true;
+                continue;
+            }
+            if (conn.inflightCount == 0)
+            {
+                continue;
+            }
+            uint64_t latency = static_cast<uint64_t>(std::max<int64_t>(now - conn.inflight[conn.inflightHead], 0));
+            conn.inflightHead = (conn.inflightHead + 1) % this->pipeline;
+            conn.inflightCount--;
+            recordLatency(worker, latency);
+            worker.completed++;
+        }
+        if (got < static_cast<ssize_t>(sizeof(buffer)))
+        {
+            return true;
+        }
+    }
+}
+
+void TCPBench::recordLatency(bench_worker &worker, uint64_t latency) {
+    worker.histogram[LatencyHistogram::bucketFor(latency)]++;
+    worker.maxNs = std::max(worker.maxNs, latency);
+}
+
+/**********************************************************************************************
+ * recordUnanswered - Run over: every command still in flight and, at a fixed rate, every slot
+ *                    that came due before the end without being sent (the server held the
+ *                    pipeline full) is recorded as a timeout, its latency taken up to now.
+ *                    Connections that failed are already counted as errors.
+ *
+ **********************************************************************************************/
+
+void TCPBench::recordUnanswered(bench_worker &worker, int64_t now) {
+    int64_t intervalNs = (this->rate > 0) ? static_cast<int64_t>((1000000000.0 * this->connections) / this->rate) : 0;
+    for (bench_conn &conn : worker.conns)
+    {
+        if (conn.fd < 0)
+        {
+            continue;
+        }
+        for (size_t i = 0; i < conn.inflightCount; i++)
+        {
+            recordLatency(worker, static_cast<uint64_t>(std::max<int64_t>(now - conn.inflight[(conn.inflightHead + i) % this->pipeline], 0)));
+            worker.timedOut++;
+        }
+        conn.inflightCount = 0;
+        if (intervalNs <= 0)
+        {
+            continue;
+        }
+        for (; conn.nextDueNs < this->endNs; conn.nextDueNs += intervalNs)
+        {
+            recordLatency(worker, static_cast<uint64_t>(std::max<int64_t>(now - conn.nextDueNs, 0)));
+            worker.unsent++;
+        }
+    }
+}
+
+//upper edge of the bucket holding the given fraction of samples
+uint64_t TCPBench::percentileNs(double fraction) const {
+    uint64_t target = static_cast<uint64_t>(fraction * (this->completed + this->timedOut + this->unsent));
+    if (target < 1)
+    {
+        target = 1;
+    }
+    uint64_t seen = 0;
+    for (unsigned int b = 0; b < METRIC_BUCKETS; b++)
+    {
+        seen += this->histogram[b];
+        if (seen >= target)
+        {
+            uint64_t upper = (b + 1 < METRIC_BUCKETS) ? LatencyHistogram::bucketLow(b + 1) - 1 : this->maxNs;
+            return std::min(upper, this->maxNs);
+        }
+    }
+    return this->maxNs;
+}
+
+void TCPBench::printReport() {
+    //the drain after the end only finishes commands sent inside the window, it is not counted
+    double measured = (this->endNs - this->startNs) / 1e9;
+    uint64_t samples = this->completed + this->timedOut + this->unsent;
+
+    printf("tcpbench: %u connections, %u threads, pipeline %u, ", this->connections, this->threadCount, this->pipeline);
+    if (this->rate > 0)
+    {
+        printf("fixed rate %llu/s, %.1fs\n", (unsigned long long)this->rate, measured);
+    }
+    else
+    {
+        printf("closed loop, %.1fs\n", measured);
+    }
+    printf("  requests:   %llu sent, %llu completed, %llu connection errors\n",
+           (unsigned long long)this->sent, (unsigned long long)this->completed, (unsigned long long)this->errors);
+    if ((this->timedOut > 0) || (this->unsent > 0))
+    {
+        printf("  timeouts:   %llu unanswered, %llu due but never sent (counted in the latencies)\n",
+               (unsigned long long)this->timedOut, (unsigned long long)this->unsent);
+    }
+    printf("  throughput: %.0f req/s\n", this->completed / ((measured > 0) ? measured : 1));
+    if (samples > 0)
+    {
+        printf("  latency us: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+               percentileNs(0.50) / 1000.0, percentileNs(0.90) / 1000.0, percentileNs(0.99) / 1000.0,
+               percentileNs(0.999) / 1000.0, this->maxNs / 1000.0);
+    }
+    if (this->rate > 0)
+    {
+        printf("  (measured from intended send times, corrected for coordinated omission)\n");
+    }
+}
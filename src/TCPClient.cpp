@@ -5,7 +5,14 @@
 #include <string.h>
 #include <unistd.h>
 #include <vector>
-#include <sstream>
+#include <fstream>
+#include <deque>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <errno.h>
+#include <stdio.h>
+#include <poll.h>
 
 //networking headers
 #include <sys/socket.h> // Core BSD socket functions and data structures.
@@ -65,73 +72,321 @@ void TCPClient::connectTo(const char *ip_addr, unsigned short port) {
 }
 
 /**********************************************************************************************
- * handleConnection - Performs a loop that checks if the connection is still open, then 
- *                    looks for user input and sends it if available. Finally, looks for data
- *                    on the socket and sends it.
+ * handleConnection - Waits on the socket and stdin together with poll, so server output is
+ *                    shown the moment it arrives and each typed line is sent as soon as it
+ *                    is complete. After "exit" or the end of stdin nothing more is sent and
+ *                    the loop only waits for the server to finish and close. In batch mode
+ *                    runs the command file instead.
  * 
  *    Throws: socket_error for recoverable errors, runtime_error for unrecoverable types
  **********************************************************************************************/
 
 void TCPClient::handleConnection() {
-    //variable for input/output commands and reading data
-    int valread;
-    std::string command;
-    char buffer[1024] = {0}; 
-    std::string readBuffer = "";
+    if (!this->batchFile.empty())
+    {
+        runBatch();
+        return;
+    }
+
+    //poll rather than epoll: stdin may be a regular file when commands are piped in
+    struct pollfd watched[2];
+    watched[0].fd = this->socketFD;
+    watched[0].events = POLLIN;
+    watched[1].fd = STDIN_FILENO;
+    watched[1].events = POLLIN;
 
-    //bool bootUp = true; used for testing multiple cmds
-    
     //Main loop for sending and recieving data from server
     while (true)
     {
-        //flush for avoid errors, displays any late/mulitple messages
-        std::cout.flush();
-        //reads and displays message on console
-        valread = read( this->socketFD, buffer, 1024);
-        std::cout << buffer;
-        //flush for avoid errors
+        //once input is done stdin is no longer watched
+        nfds_t watchCount = this->inputDone ? 1 : 2;
+        int ready = poll(watched, watchCount, -1);
+        if (ready < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw socket_error(std::string("poll failed: ") + strerror(errno));
+        }
+
+        //server output first, so replies are never held up behind typing
+        if (watched[0].revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            if (!readServer())
+            {
+                break;
+            }
+        }
+
+        if ((watchCount > 1) && (watched[1].revents & (POLLIN | POLLHUP | POLLERR)))
+        {
+            readInput();
+        }
+    }
+}
+
+/**********************************************************************************************
+ * readServer - Copies whatever the server has sent straight to stdout. Returns false once
+ *              the server has closed the connection.
+ *
+ *    Throws: socket_error if the read fails
+ **********************************************************************************************/
+
+bool TCPClient::readServer() {
+    char buffer[socket_bufsize];
+    ssize_t valread = read(this->socketFD, buffer, sizeof(buffer));
+    if ((valread < 0) && (errno == EINTR))
+    {
+        return true;
+    }
+    if ((valread < 0) && (errno == ECONNRESET))
+    {
+        valread = 0;
+    }
+    errorCheck(valread, "read failed\n");
+    if (valread == 0)
+    {
+        std::cout << "\nServer closed the connection\n";
         std::cout.flush();
-        //clears the buffer
-        memset(buffer, 0, 1024);
-
-        //take command and add newline to signifiy complete command
-        std::cin >> command;
-        //adds to newline to signify end of command
-        command = command + '\n';
-        
-        /*testing multiple commands
-        if (bootUp)
+        return false;
+    }
+
+    std::cout.write(buffer, valread);
+    std::cout.flush();
+    return true;
+}
+
+/**********************************************************************************************
+ * readInput - Reads what is available on stdin and sends every complete line, newline
+ *             included. A partial line waits in inputPending for the rest. Returns false
+ *             once no more input will be sent.
+ *
+ *    Throws: socket_error if the send fails
+ **********************************************************************************************/
+
+bool TCPClient::readInput() {
+    char buffer[stdin_bufsize];
+    ssize_t got = read(STDIN_FILENO, buffer, sizeof(buffer));
+    if ((got < 0) && (errno == EINTR))
+    {
+        return true;
+    }
+    if (got <= 0)
+    {
+        //end of input: send a last unterminated line, then tell the server nothing more is coming
+        if (!this->inputPending.empty())
         {
-            command = "hello"; command = command + '\n';
-            command = command + "1"; command = command + '\n';
-            command = command + "2"; command = command + '\n';
-            command = command + "3"; command = command + '\n';
-            command = command + "4"; command = command + '\n';
-            command = command + "5"; command = command + '\n';
-            command = command + "6"; command = command + '\n';
-            bootUp = false;
+            this->inputPending += '\n';
+            sendAll(this->inputPending.data(), this->inputPending.size());
+            this->inputPending.clear();
         }
-        else{
-            std::cin >> command;
-            command = command + '\n';
-        }*/
-
-        //converts to char star and sends to server
-        const char *sendCmd = command.c_str();
-        send(this->socketFD, const_cast<char *>(sendCmd) , strlen(sendCmd) , 0 );
-        //User message for awarness 
-        std::cout << "Command message sent\n\n" ; 
-        //checks if user is exiting
+        shutdown(this->socketFD, SHUT_WR);
+        this->inputDone = true;
+        return false;
+    }
+    this->inputPending.append(buffer, got);
+
+    size_t lineStart = 0;
+    size_t newline;
+    while ((newline = this->inputPending.find('\n', lineStart)) != std::string::npos)
+    {
+        //lines are sent as typed, the server handles arguments and carriage returns
+        sendAll(this->inputPending.data() + lineStart, newline + 1 - lineStart);
+        std::string command = this->inputPending.substr(lineStart, newline - lineStart);
+        lineStart = newline + 1;
+
+        //checks if user is exiting, the server replies and closes the connection itself
         clrNewlines(command);
-        if (command == "exit"){
-            //exits out of loop and proceeds to shutdown
+        if (command == "exit")
+        {
+            this->inputPending.clear();
+            this->inputDone = true;
+            return false;
+        }
+    }
+    this->inputPending.erase(0, lineStart);
+    return true;
+}
+
+//send until everything is taken, the socket is blocking so this only loops on short writes
+void TCPClient::sendAll(const char *data, size_t length) {
+    while (length > 0)
+    {
+        ssize_t sent = send(this->socketFD, data, length, MSG_NOSIGNAL);
+        if ((sent < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+        errorCheck(sent, "send failed\n");
+        data += sent;
+        length -= sent;
+    }
+}
+
+/**********************************************************************************************
+ * setBatch - Switches handleConnection to batch mode: the commands in path (one per line)
+ *            are sent repeat times over, keeping up to depth of them in flight.
+ *
+ **********************************************************************************************/
+
+void TCPClient::setBatch(const std::string &path, unsigned int repeat, unsigned int depth) {
+    this->batchFile = path;
+    this->batchRepeat = (repeat < 1) ? 1 : repeat;
+    this->batchDepth = (depth < 1) ? 1 : depth;
+}
+
+/**********************************************************************************************
+ * countPrompts - Returns how many COMMAND: prompts end in data. A prompt split over two reads
+ *                is counted by the read that completes it.
+ *
+ **********************************************************************************************/
+
+size_t TCPClient::countPrompts(const char *data, size_t length) {
+    static const char prompt[] = "COMMAND:";
+    const size_t promptLength = sizeof(prompt) - 1;
+    size_t found = 0;
+
+    //the prompt has no repeated prefix, so a mismatch only has to check for a new 'C'
+    for (size_t i = 0; i < length; i++)
+    {
+        if (data[i] == prompt[this->promptMatched])
+        {
+            this->promptMatched++;
+        }
+        else
+        {
+            this->promptMatched = (data[i] == prompt[0]) ? 1 : 0;
+        }
+        if (this->promptMatched == promptLength)
+        {
+            this->promptMatched = 0;
+            found++;
+        }
+    }
+    return found;
+}
+
+/**********************************************************************************************
+ * runBatch - Sends the batch file's commands and times each one from its send to the prompt
+ *            that ends its reply, which is how replies are matched to commands (the server
+ *            must not batch prompts, -B). Prints one line per command and a summary. A line
+ *            reading "exit" ends the script; blank lines are skipped.
+ *
+ *    Throws: runtime_error if the file can not be read, socket_error on connection errors
+ **********************************************************************************************/
+
+void TCPClient::runBatch() {
+    std::ifstream file(this->batchFile);
+    if (!file)
+    {
+        throw std::runtime_error("Unable to open command file " + this->batchFile);
+    }
+    std::vector<std::string> commands;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        clrNewlines(line);
+        if (line == "exit")
+        {
             break;
         }
-        std::cout.flush();
+        if (!line.empty())
+        {
+            commands.push_back(line);
+        }
+    }
+    if (commands.empty())
+    {
+        throw std::runtime_error("No commands in " + this->batchFile);
+    }
+
+    typedef std::chrono::steady_clock clock;
+    size_t total = commands.size() * this->batchRepeat;
+    std::vector<double> rttMs;
+    rttMs.reserve(total);
+    //send times of the commands in flight, oldest first
+    std::deque<clock::time_point> inflight;
+    size_t nextToSend = 0;
+    bool greeted = false;
+    char buffer[socket_bufsize];
+    clock::time_point started = clock::now();
+
+    std::cout << "Sending " << commands.size() << " commands x " << this->batchRepeat
+              << ", pipeline depth " << this->batchDepth << "\n";
+
+    while (rttMs.size() < total)
+    {
+        //the greeting's prompt comes first, then keep the pipeline full
+        if (greeted)
+        {
+            std::string burst;
+            while ((inflight.size() < this->batchDepth) && (nextToSend < total))
+            {
+                burst += commands[nextToSend % commands.size()];
+                burst += '\n';
+                inflight.push_back(clock::now());
+                nextToSend++;
+            }
+            if (!burst.empty())
+            {
+                sendAll(burst.data(), burst.size());
+            }
+        }
 
-        //temporary sleep for performance
-        sleep(1);
+        ssize_t valread = read(this->socketFD, buffer, sizeof(buffer));
+        if ((valread < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+        errorCheck(valread, "read failed\n");
+        if (valread == 0)
+        {
+            std::cout << "Server closed the connection after " << rttMs.size() << " of " << total << " replies\n";
+            break;
+        }
+        clock::time_point now = clock::now();
+
+        for (size_t found = countPrompts(buffer, valread); found > 0; found--)
+        {
+            if (!greeted)
+            {
+                greeted = true;
+                started = now;
+                continue;
+            }
+            if (inflight.empty())
+            {
+                continue;
+            }
+            double ms = std::chrono::duration<double, std::milli>(now - inflight.front()).count();
+            inflight.pop_front();
+            printf("%8zu  %-16s %10.3f ms\n", rttMs.size() + 1, commands[rttMs.size() % commands.size()].c_str(), ms);
+            rttMs.push_back(ms);
+        }
+    }
+
+    double elapsed = std::chrono::duration<double>(clock::now() - started).count();
+    if (rttMs.empty())
+    {
+        return;
+    }
+    double sum = 0;
+    for (double ms : rttMs)
+    {
+        sum += ms;
     }
+    std::vector<double> sorted = rttMs;
+    std::sort(sorted.begin(), sorted.end());
+    //nearest rank percentile
+    auto percentile = [&sorted](double fraction) {
+        size_t rank = static_cast<size_t>(fraction * sorted.size() + 0.999999);
+        return sorted[(rank < 1) ? 0 : std::min(rank, sorted.size()) - 1];
+    };
+    printf("%zu replies in %.3f s, %.1f commands/s\n", rttMs.size(), elapsed, rttMs.size() / ((elapsed > 0) ? elapsed : 1));
+    printf("RTT ms: min %.3f  avg %.3f  p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n", sorted.front(), sum / sorted.size(),
+           percentile(0.50), percentile(0.90), percentile(0.99), sorted.back());
+    std::cout.flush();
 }
 
 /**********************************************************************************************
@@ -0,0 +1,75 @@
+#include "TCPConn.h"
+
+#include <string.h>
+#include <algorithm>
+
+//networking headers
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+//zeroes a string's whole buffer, not just its length, before emptying it
+static void wipeString(std::string &text) {
+    if (text.capacity() > 0)
+    {
+        explicit_bzero(&text[0], text.capacity());
+    }
+    text.clear();
+}
+
+void secret_buffer::wipe() {
+    wipeString(this->text);
+}
+
+TCPConn::TCPConn() {
+}
+
+TCPConn::~TCPConn() {
+    clearSecrets();
+}
+
+/**********************************************************************************************
+ * setPeer - Formats the client's address once so nothing needs getpeername or a stringstream
+ *           later. IPv4 clients of a dual-stack socket are shown in their plain IPv4 form.
+ *
+ **********************************************************************************************/
+
+void TCPConn::setPeer(const struct sockaddr *peer) {
+    char ipText[INET6_ADDRSTRLEN] = "";
+    unsigned short port = 0;
+
+    if (peer->sa_family == AF_INET)
+    {
+        const struct sockaddr_in *peer4 = reinterpret_cast<const struct sockaddr_in *>(peer);
+        inet_ntop(AF_INET, &peer4->sin_addr, ipText, sizeof(ipText));
+        port = ntohs(peer4->sin_port);
+    }
+    else if (peer->sa_family == AF_INET6)
+    {
+        const struct sockaddr_in6 *peer6 = reinterpret_cast<const struct sockaddr_in6 *>(peer);
+        if (IN6_IS_ADDR_V4MAPPED(&peer6->sin6_addr))
+        {
+            inet_ntop(AF_INET, &peer6->sin6_addr.s6_addr[12], ipText, sizeof(ipText));
+        }
+        else
+        {
+            inet_ntop(AF_INET6, &peer6->sin6_addr, ipText, sizeof(ipText));
+        }
+        port = ntohs(peer6->sin6_port);
+    }
+
+    this->peerIP = ipText;
+    this->peerPort = port;
+}
+//names have been checked against the store already, so they fit
+void TCPConn::setUser(std::string_view name) {
+    this->usernameLen = static_cast<uint8_t>(std::min(name.size(), sizeof(this->username)));
+    memcpy(this->username, name.data(), this->usernameLen);
+}
+
+//overwrites the pending new password before letting go of it
+void TCPConn::clearSecrets() {
+    if (!this->newPasswd.empty())
+    {
+        wipeString(this->newPasswd);
+    }
+}
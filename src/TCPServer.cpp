@@ -5,33 +5,67 @@
 #include <unistd.h>
 #include <vector>
 #include <string.h>
-#include <sstream>
 #include <memory>
 #include <algorithm>
+#include <thread>
+#include <string_view>
+#include <array>
+#include <errno.h>
+#include <chrono>
+#include <time.h>
 
 //networking headers
 #include <sys/socket.h> // Core BSD socket functions and data structures.
 #include <netinet/in.h> // AF_INET and AF_INET6 address families and their corresponding protocol families PF_INET and PF_INET6.
 #include <arpa/inet.h>  // Functions for manipulating numeric IP addresses.
 #include <netdb.h>
+#include <netinet/tcp.h>
 
 //for non-blocking
 #include <fcntl.h>
 
+//for raising the open file limit
+#include <sys/resource.h>
+
 #include "exceptions.h"
 #include "strfuncts.h"
+#include "CommandTable.h"
+#include "ResponseStore.h"
+#include "AdmissionControl.h"
+#include "WorkerPool.h"
+#include "SessionTickets.h"
+#include "Logger.h"
+#include "Metrics.h"
 
-#define MAX_CLIENTS 2
+//how many connections the table is sized for before it has to grow
+#define INITIAL_CLIENTS 1024
 
+//free space guaranteed in a client's input buffer before each read
+#define READ_CHUNK 2048
 
-TCPServer::TCPServer() {
-    //creates and initializes client vector to the max number of clients
-    for (int i = 0; i < MAX_CLIENTS; i++)
-    {
-        std::unique_ptr<socket_obj> newSocket = std::make_unique<socket_obj>();
-        this->clientObj_sockets.push_back(std::move(newSocket));
-    }
+//longest command a client may leave unterminated before it is thrown away
+#define MAX_COMMAND_LENGTH 65536
+
+//drained read blocks a loop keeps for reuse, beyond that they are freed
+#define CACHED_READ_BLOCKS 1024
+
+//retry delay for accepts deferred at the fd limit when no client of this loop closes
+#define ACCEPT_RETRY_MS 100
+
+//password check results handed back from the worker pool
+static const char login_ok[] = "ok";
+static const char login_failed[] = "failed";
+
+
+static void nameCommandMetrics();
 
+TCPServer::TCPServer():readBlocks(READ_CHUNK, CACHED_READ_BLOCKS) {
+    //connection table grows on demand, this just avoids early regrowth
+    this->clientObj_sockets.reserve(INITIAL_CLIENTS);
+
+    //every loop records into its own shard, merged only when stats are read
+    this->metrics = Metrics::instance().newShard();
+    nameCommandMetrics();
 }
 
 
@@ -56,6 +90,17 @@ void TCPServer::bindSvr(const char *ip_addr, short unsigned int port) {
     //this->socketFD = -1; //error testing
     //making sure socket was create without errors
     errorCheck(this->socket_FD, "Server socket failed");
+
+    //remembered so worker shards can bind their own sockets to the same address
+    this->bindIP = ip_addr;
+    this->bindPort = port;
+
+    //every shard gets its own listening socket on the same port, the kernel spreads connections across them
+    int optVal = 1;
+    if (this->threadCount > 1)
+    {
+        errorCheck(setsockopt(this->socket_FD, SOL_SOCKET, SO_REUSEPORT, &optVal, sizeof(optVal)), "Server SO_REUSEPORT failed");
+    }
     /********************************************************************
     * The variable serv_addr is a structure of type struct sockaddr_in. 
     * This structure has four fields. The first field is short sin_family, 
@@ -101,313 +146,1513 @@ void TCPServer::bindSvr(const char *ip_addr, short unsigned int port) {
  *             them. Also loops through the list of connections and handles data received and
  *             sending of data. 
  *
+ *             The server socket and every client socket are registered once with an
+ *             edge-triggered epoll instance, so the loop only wakes up when one of them is
+ *             actually ready and never has to walk idle clients.
+ *
  *    Throws: socket_error for recoverable errors, runtime_error for unrecoverable types
  **********************************************************************************************/
 
 void TCPServer::listenSvr() {
-    //index for largest file descriptor
-    int maxFD = 0;
-    
-    //buffer for read and write communications
-    char buffer[1024] = {0}; 
+    //puts the socket in listening mode and starts any extra shards
+    prepareListen();
 
-    //sets socket to listen with max queue size of 3
-    int lisCheck = listen(this->socket_FD, 3);
-    //checks for errors
-    errorCheck(lisCheck, "Server listen failed");
-    //sets the size for addrlen to pass as a parameter into socket accept function
-    int addrLen = sizeof(this->address);
+    //server socket only needs to be registered once, edge-triggered so accepts are drained in a loop
+    this->eventLoop.add(this->socket_FD, EPOLLIN | EPOLLET);
+    //level-triggered, takeAll clears the eventfd every time it is read
+    this->eventLoop.add(this->completions.fd(), EPOLLIN);
+    this->loopNowMs = monotonicMs();
+    this->timers.advance(this->loopNowMs, this->expiredClients);
 
-    //file descriptor set container for select function
-    fd_set readSet;
-    
     //main loop that continously reads and sends data 
-    while(true)
+    while(!this->stopRequested.load(std::memory_order_relaxed))
     {
-        //zeroizes readSet set
-        FD_ZERO(&readSet);
-        //add server socket to readSet
-        FD_SET(this->socket_FD, &readSet);
-        int maxFD  = this->socket_FD; //initializes max file descripter to server socket
-        int currentClientFD = 0; //index while iterating through client
-
-        //adds all exiting clients to readSet
-        for (int i = 0; i < MAX_CLIENTS; i++){
-            currentClientFD = this->clientObj_sockets.at(i)->socketObjFD;
-
-            //checks if vector has client associated to that index
-            if(currentClientFD > 0)
-            {   
-                //add client file descriptor to readset
-                FD_SET( currentClientFD , &readSet);   
-            }    
-            //highest file descriptor number, need it for the select function  
-            if(currentClientFD > maxFD )
+        //sleeps until a socket is ready or the next client timeout is due, forever if there is none
+        int readyCount = this->eventLoop.wait(nextWaitMs());
+        this->loopNowMs = monotonicMs();
+
+        //picks up replies reloaded from the response file
+        refreshResponses();
+
+        for (int i = 0; i < readyCount; i++)
+        {
+            const struct epoll_event &ev = this->eventLoop.event(i);
+
+            //checks if any new clients have connected
+            if (ev.data.fd == this->socket_FD)
+            {
+                acceptClients();
+            }
+            //replies from the worker pool
+            else if (ev.data.fd == this->completions.fd())
+            {
+                drainCompletions();
+            }
+            else
             {
-                maxFD = currentClientFD;
+                handleClient(ev.data.fd, ev.events);
             }
         }
-        //create timeval struct to pass into the last select option
-        struct timeval timeOut;
-        timeOut.tv_sec = 0;
-        timeOut.tv_usec = 500000;
-
-        //indicates which of the specified file descriptors is ready for reading, ready for writing, or has an error condition pending
-        int activity = select( maxFD + 1 , &readSet , NULL , NULL , &timeOut);    
 
-        //error checks the select function
-        if ((activity < 0) && (errno!=EINTR))
+        //everything replied during this pass is written before sleeping again
+        expireClients();
+        //the listener is edge-triggered, connections left queued at the fd limit get no new edge
+        if (acceptRetryDue())
         {
-            std::cout << "error with select function\n";
+            acceptClients();
         }
+        flushPending();
+        publishStats();
+    }
+}
 
-        //checks if any new clients have connected
-        if (FD_ISSET(this->socket_FD, &readSet))
-        {
-            //accepts the connection and error check is conducted
-            int setSocket = accept(this->socket_FD, reinterpret_cast<struct sockaddr *>(&this->address), reinterpret_cast<socklen_t*>(&addrLen));
-            errorCheck(setSocket, "Server accept failed");
+/**********************************************************************************************
+ * prepareListen - Steps shared by every engine before its loop starts: puts the server socket
+ *                 in listening mode, raises the open file limit and starts the extra shards.
+ *
+ *    Throws: socket_error if listen fails
+ **********************************************************************************************/
 
-            //Server Admin Alert
-            std::cout << "New connection created: socket " << setSocket << "\n";
-            
-            //Welcome message and menu
-            sendMessageToClient(setSocket, "Hello Client!\n\nCOMMAND MENU\nhello: Welcome message\n1: Current IP Address\n2: Current Port\n3: Displays Graphic\n4: Displays Graphic\n5: Displays Graphic\npasswd: Change Password\nexit: Disconnect From Server\nmenu: Displays Menu\n\nCOMMAND:");
-
-            //Server Admin Notification
-            std::cout << "Hello message sent to socket: " << setSocket << "\n"; 
-
-            //adds new client to vector
-            for (int i = 0; i < MAX_CLIENTS; i++)   
-            {   
-                //find first position that empty
-                if( this->clientObj_sockets.at(i)->socketObjFD == 0 ) 
-                {   
-                    //add new client socket to vector  
-                    this->clientObj_sockets.at(i)->socketObjFD = setSocket;
-                    std::cout << "Adding to list of sockets as " << i << "\n";   
-                    break;   
-                }   
-            }
-        }
+void TCPServer::prepareListen() {
+    //only wakes the acceptor once the client has sent data, the kernel caps the wait at the timeout
+    if (this->deferAcceptSecs > 0)
+    {
+        errorCheck(setsockopt(this->socket_FD, IPPROTO_TCP, TCP_DEFER_ACCEPT, &this->deferAcceptSecs, sizeof(this->deferAcceptSecs)), "Server TCP_DEFER_ACCEPT failed");
+    }
 
-        //iterates through client list to process commands
-        for (int currentVectorIndex = 0; currentVectorIndex < MAX_CLIENTS; currentVectorIndex++)   
-        {   
-            //current client index
-            currentClientFD = this->clientObj_sockets.at(currentVectorIndex)->socketObjFD;     
-
-            //checks if client sent a command    
-            if (FD_ISSET( currentClientFD , &readSet))   
-            {   
-                //Check if connection was lost; else reads the incoming message  
-                int valRead = read( currentClientFD, buffer, 1024);
-                if (valRead == 0)   
-                {   
-                    //Somebody disconnected , get his details and print  
-                    printDisconnectedClientInfo(currentClientFD);
-                        
-                    //Close the socket and mark as 0 in list for reuse  
-                    closeClient(currentClientFD, currentVectorIndex); 
-                }
-                else 
-                {   
-                    //set the string terminating NULL byte on the end of the data read  
-                    buffer[valRead] = '\0';
-                    //Alerting Admin of socket message
-                    std::cout << "socket "<< currentClientFD << ": " << buffer;//testing
-                    
-                    //convert buffer arrar to string for better manipulation
-                    std::string readCommandStr(buffer);
-
-                    //adds message to command buffer
-                    this->clientObj_sockets.at(currentVectorIndex)->command = this->clientObj_sockets.at(currentVectorIndex)->command + readCommandStr;
-
-                    //if command is incomplete server will continue on to other socket and check this one again in the next iteration
-                    size_t newlineCmdCount = std::count(this->clientObj_sockets.at(currentVectorIndex)->command.begin(), this->clientObj_sockets.at(currentVectorIndex)->command.end(), '\n');
-                    //if (completeCmd < 1){
-                    std::cout << "newlines: " << newlineCmdCount << std::endl;
-                    if (newlineCmdCount < 1){
-                        //Alert to Server Admin
-                        std::cout << "partial cmd from client: " << currentClientFD << "\n";
-                        continue;
-                    }
-                    //variables for multiple command processing
-                    size_t pos = 0;
-                    std::string token;
-                    std::string delimiter = "\n";
-
-                    //loops continue until all commands in a string are processed
-                    while((newlineCmdCount > 0) && ((pos = this->clientObj_sockets.at(currentVectorIndex)->command.find(delimiter)) != std::string::npos))
-                    {
-                        //separates the 1st command from the string if multiple commands are sent at once
-                        if (newlineCmdCount > 1)
-                        {
-                                readCommandStr = this->clientObj_sockets.at(currentVectorIndex)->command.substr(0, pos);
-                                //std::cout << readCommandStr << std::endl;//testing
-                                //erases the command to be processed for original string
-                                this->clientObj_sockets.at(currentVectorIndex)->command.erase(0, pos + delimiter.length());
-                        }
-                        else{
-                            //transfers complete command
-                            readCommandStr = this->clientObj_sockets.at(currentVectorIndex)->command;
-                            //clears command buffer to avoid errors
-                            this->clientObj_sockets.at(currentVectorIndex)->command = "";
-                        }
-
-                        //clear away the newline character from command to ensure proper match
-                        clrNewlines(readCommandStr);
-
-                        //Sends Hello message
-                        if (readCommandStr == "hello")
-                        {
-                            sendMessageToClient(currentClientFD, "(>n_n)> Hello Client\n\nCOMMAND:");
-                        }
-                        //closes client's connection
-                        else if (readCommandStr == "exit")
-                        {
-                            closeClient(currentClientFD, currentVectorIndex);
-                        }
-                        //TODO: HW2
-                        else if (readCommandStr == "passwd")
-                        {
-                            sendMessageToClient(currentClientFD, "TODO: Implement in HW2\n\nCOMMAND:");
-
-                        }
-                        //Displays menu
-                        else if (readCommandStr == "menu")
-                        {
-                            sendMessageToClient(currentClientFD, "COMMAND MENU\nhello: Welcome message\n1: Current IP Address\n2: Current Port\n3: Displays Graphic\n4: Displays Graphic\n5: Displays Graphic\npasswd: Change Password\nexit: Disconnect From Server\nmenu: Displays Menu\n\nCOMMAND:");
-                        }
-                        //Checks if command was an int after string comparisons
-                        else
-                        {
-                            checkForIntCommand(const_cast<char *>(readCommandStr.c_str()), currentClientFD);
-                        }
-                        newlineCmdCount--;
-                    }
-                }   
-            }   
-        }  
+    //sets socket to listen, a deep queue absorbs reconnect storms (the kernel caps it at somaxconn)
+    int lisCheck = listen(this->socket_FD, this->listenBacklog);
+    //checks for errors
+    errorCheck(lisCheck, "Server listen failed");
+
+    //lets the connection table grow as far as the hard file descriptor limit allows
+    struct rlimit fdLimit;
+    if ((getrlimit(RLIMIT_NOFILE, &fdLimit) == 0) && (fdLimit.rlim_cur < fdLimit.rlim_max))
+    {
+        fdLimit.rlim_cur = fdLimit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &fdLimit);
     }
+
+    //every loop keeps its own reference to the current replies
+    refreshResponses();
+
+    //extra event loops each get their own socket, connection table and thread
+    startShards();
 }
 
 /**********************************************************************************************
- * shutdown - Cleanly closes the socket FD.
+ * refreshResponses - Handles a pending reload request and re-fetches the reply snapshot if
+ *                    the store has published a new one. Costs one atomic load when nothing
+ *                    changed, so loops call it on every wakeup.
  *
- *    Throws: socket_error for recoverable errors, runtime_error for unrecoverable types
  **********************************************************************************************/
 
-void TCPServer::shutdown() {
-    //closes the client sockets
-    for (int i = 0; i < MAX_CLIENTS; i++){
-        //closeClient(this->client_sockets.at(i), i);
-        closeClient(this->clientObj_sockets.at(i)->socketObjFD, i);
+void TCPServer::refreshResponses() {
+    ResponseStore &store = ResponseStore::instance();
+    if (store.takeReloadRequest())
+    {
+        store.reload();
+    }
+    uint64_t currentVersion = store.version();
+    if (currentVersion != this->responsesVersion)
+    {
+        this->responses = store.snapshot();
+        this->responsesVersion = currentVersion;
     }
-    //closes server client
-    close(this->socket_FD);
 }
 
-void TCPServer::closeClient(int inputClientFD, int index){
-    std::cout << "Closing client socket: " << inputClientFD << "\n";
-    //closes client
-    close( inputClientFD );   
-    //reset vector tracker
-    //client_sockets.at(index) = 0; 
-    this->clientObj_sockets.at(index)->socketObjFD = 0;
+/**********************************************************************************************
+ * setThreads - Sets how many independent event loops listenSvr runs. Must be called before
+ *              bindSvr so the listening socket is created with SO_REUSEPORT.
+ *
+ **********************************************************************************************/
+
+void TCPServer::setThreads(unsigned int threads) {
+    this->threadCount = (threads < 1) ? 1 : threads;
 }
 
-//Throws error if input < 0
-void TCPServer::errorCheck(int input, std::string errMess){
-    if (input < 0)
+/**********************************************************************************************
+ * setHighWater - Sets how many bytes of unsent replies a client may have before the server
+ *                stops reading its commands. Reading resumes once half of it has drained.
+ *
+ **********************************************************************************************/
+
+void TCPServer::setHighWater(size_t bytes) {
+    this->highWater = (bytes < 1) ? 1 : bytes;
+}
+
+/**********************************************************************************************
+ * setBatchPrompt - With batching on, replies to pipelined commands go out back to back and the
+ *                  COMMAND: prompt is sent once after the last reply of each write, instead of
+ *                  after every reply.
+ *
+ **********************************************************************************************/
+
+void TCPServer::setBatchPrompt(bool enabled) {
+    this->batchPrompt = enabled;
+}
+
+/**********************************************************************************************
+ * setBacklog - Sets the length of the listen queue, connections waiting there have finished the
+ *              handshake but have not been accepted yet.
+ *
+ **********************************************************************************************/
+
+void TCPServer::setBacklog(int backlog) {
+    this->listenBacklog = (backlog < 1) ? SOMAXCONN : backlog;
+}
+
+/**********************************************************************************************
+ * setDeferAccept - Turns on TCP_DEFER_ACCEPT so a connection is only accepted once the client
+ *                  has sent something, or the timeout passed. Clients of this protocol wait for
+ *                  the greeting first, so this only suits clients that send a command right away.
+ *
+ **********************************************************************************************/
+
+void TCPServer::setDeferAccept(int seconds) {
+    this->deferAcceptSecs = (seconds < 0) ? 0 : seconds;
+}
+
+/**********************************************************************************************
+ * setIdleTimeout - Closes clients that send nothing at all for this long (0 = never)
+ * setReadTimeout - Closes clients that leave a command unfinished for this long (0 = never),
+ *                  so a client trickling a line in can not hold its slot forever
+ *
+ **********************************************************************************************/
+
+void TCPServer::setIdleTimeout(unsigned int seconds) {
+    this->idleTimeoutMs = static_cast<int64_t>(seconds) * 1000;
+}
+
+void TCPServer::setReadTimeout(unsigned int seconds) {
+    this->readTimeoutMs = static_cast<int64_t>(seconds) * 1000;
+}
+
+/**********************************************************************************************
+ * setCommandRate - Limits every client to perSecond commands on average, with bursts of up to
+ *                  burst commands (at least one second's worth). 0 turns the limit off.
+ *
+ **********************************************************************************************/
+
+void TCPServer::setCommandRate(unsigned int perSecond, unsigned int burst) {
+    this->commandRate = perSecond;
+    this->commandBurst = std::max(burst, perSecond);
+}
+
+/**********************************************************************************************
+ * setPasswords - Makes clients log in as a user of the store before they get the menu, and
+ *                lets passwd change their password in it. Without a store there is no login.
+ *
+ **********************************************************************************************/
+
+void TCPServer::setPasswords(std::shared_ptr<PasswdMgr> store) {
+    this->passwords = store;
+}
+
+/**********************************************************************************************
+ * startShards - Binds and starts threadCount - 1 extra TCPServer shards. Each shard is a complete
+ *               server with its own SO_REUSEPORT listening socket, epoll instance and connection
+ *               table, so the threads never share any state and need no locks.
+ *
+ *    Throws: socket_error if a shard can not bind its socket
+ **********************************************************************************************/
+
+void TCPServer::startShards() {
+    //only the first server spawns shards, the shards themselves just run their loop
+    if (this->shardID != 0)
     {
-        throw socket_error(errMess);
+        return;
+    }
+
+    for (unsigned int i = 1; i < this->threadCount; i++)
+    {
+        std::unique_ptr<TCPServer> shard = newShard();
+        shard->shardID = i;
+        shard->setThreads(this->threadCount);
+        shard->setHighWater(this->highWater);
+        shard->setBatchPrompt(this->batchPrompt);
+        shard->setBacklog(this->listenBacklog);
+        shard->setDeferAccept(this->deferAcceptSecs);
+        shard->idleTimeoutMs = this->idleTimeoutMs;
+        shard->readTimeoutMs = this->readTimeoutMs;
+        shard->commandRate = this->commandRate;
+        shard->commandBurst = this->commandBurst;
+        shard->passwords = this->passwords;
+        shard->bindSvr(this->bindIP.c_str(), this->bindPort);
+        this->shards.push_back(std::move(shard));
+    }
+
+    for (std::unique_ptr<TCPServer> &shard : this->shards)
+    {
+        TCPServer *shardPtr = shard.get();
+        this->shardThreads.emplace_back([shardPtr]() {
+            try {
+                shardPtr->listenSvr();
+            } catch (std::exception &e) {
+                LOG_ERROR("Server shard error: %s", e.what());
+            }
+        });
+    }
+    if (this->threadCount > 1)
+    {
+        LOG_INFO("Running %u event loops", this->threadCount);
     }
 }
 
-void TCPServer::sendMessageToClient(int inputClientFD, std::string message){
-    const char* messageCharStar = message.c_str();
-    send(inputClientFD , messageCharStar, strlen(messageCharStar) , 0 );  
+//creates an empty server of the same engine type to run as a shard
+std::unique_ptr<TCPServer> TCPServer::newShard() {
+    return std::make_unique<TCPServer>();
 }
 
-//Return the Client IP in a string
-std::string TCPServer::getClientIP(const int inputFD)
-{
-    int addrLen = sizeof(this->address);
-    getpeername(inputFD, reinterpret_cast<struct sockaddr *>(&this->address), reinterpret_cast<socklen_t*>(&addrLen)); 
-    std::stringstream ss;
-    ss << inet_ntoa(this->address.sin_addr);
-    return ss.str();
+/**********************************************************************************************
+ * requestStop - Asks a running listenSvr loop to return. Shutting down the read side of the
+ *               listening socket wakes the loop up so it sees the flag.
+ *
+ **********************************************************************************************/
+
+void TCPServer::requestStop() {
+    this->stopRequested.store(true, std::memory_order_relaxed);
+    ::shutdown(this->socket_FD, SHUT_RD);
 }
 
-//Displays disconnect info to console
-void TCPServer::printDisconnectedClientInfo(const int inputFD)
-{
-    int addrLen = sizeof(this->address);
-    getpeername(inputFD, reinterpret_cast<struct sockaddr *>(&this->address), reinterpret_cast<socklen_t*>(&addrLen)); 
-    std::cout << "Client disconnected , ip " << getClientIP(inputFD) << ", port " << ntohs(this->address.sin_port) << std::endl;;      
+/**********************************************************************************************
+ * acceptClients - Accepts every pending connection on the server socket. Since the server socket
+ *                 is edge-triggered this must keep going until accept reports EAGAIN. accept4
+ *                 hands back sockets that are already non-blocking and close-on-exec. At the
+ *                 file descriptor limit the rest stay queued, see deferAccept.
+ *
+ *    Throws: socket_error if accept fails for a reason other than an empty queue
+ **********************************************************************************************/
+
+void TCPServer::acceptClients() {
+    //large enough for either address family, kept local so the bind address is never touched
+    struct sockaddr_storage peerAddr;
+    unsigned int acceptedNow = 0;
+    this->acceptDeferred = false;
+
+    while(true)
+    {
+        //sets the size for addrlen to pass as a parameter into socket accept function
+        socklen_t addrLen = sizeof(peerAddr);
+
+        //accepts the connection and error check is conducted
+        //client sockets must be non-blocking so the edge-triggered reads can drain them
+        int setSocket = accept4(this->socket_FD, reinterpret_cast<struct sockaddr *>(&peerAddr), &addrLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (setSocket < 0)
+        {
+            //accept queue is empty, wait for the next edge (EINVAL once requestStop shut the socket down)
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINVAL))
+            {
+                break;
+            }
+            //client gave up before we got to it, try the next one
+            if ((errno == EINTR) || (errno == ECONNABORTED))
+            {
+                if (errno == ECONNABORTED)
+                {
+                    this->acceptCounters.aborted++;
+                }
+                continue;
+            }
+            //out of file descriptors, leave the rest queued and retry at the end of a later loop pass
+            if ((errno == EMFILE) || (errno == ENFILE))
+            {
+                deferAccept();
+                break;
+            }
+            errorCheck(setSocket, "Server accept failed");
+        }
+
+        //adds new client to the event loop and the connection table
+        this->eventLoop.add(setSocket, EPOLLIN | EPOLLRDHUP | EPOLLET);
+        openClient(setSocket, reinterpret_cast<struct sockaddr *>(&peerAddr));
+        acceptedNow++;
+    }
+
+    noteAccepts(acceptedNow);
 }
 
-//Return the Client Port in a string
-std::string TCPServer::getClientPort(const int inputFD)
-{
-    int addrLen = sizeof(this->address);
-    getpeername(inputFD, reinterpret_cast<struct sockaddr *>(&this->address), reinterpret_cast<socklen_t*>(&addrLen));  
-    std::stringstream ss;
-    ss << ntohs(this->address.sin_port);
-    return ss.str();
+/**********************************************************************************************
+ * deferAccept - Records that accept ran out of file descriptors. The queued connections are
+ *               retried at the end of the pass in which a client closes, or after
+ *               ACCEPT_RETRY_MS since the fds may be freed elsewhere in the process.
+ *
+ **********************************************************************************************/
+
+void TCPServer::deferAccept() {
+    this->acceptCounters.deferred++;
+    this->acceptDeferred = true;
+    this->acceptRetryMs = this->loopNowMs + ACCEPT_RETRY_MS;
+    if (this->loopNowMs >= this->acceptWarnMs)
+    {
+        LOG_WARN("File descriptor limit reached, deferring accept (%llu times so far)", (unsigned long long)this->acceptCounters.deferred);
+        this->acceptWarnMs = this->loopNowMs + 1000;
+    }
 }
 
-//this function processess commands which are integers
-//If command is not match, unknown command message is sent to client 
-void TCPServer::checkForIntCommand(char *inputCommand, int socket){
-    int readCommandInt = atoi(inputCommand);
-    switch (readCommandInt)
+/**********************************************************************************************
+ * noteAccepts - Adds one wakeup's accepts to the counters. Accepts are counted in one second
+ *               windows; when a window closes its rate is logged, so the speed at which a
+ *               reconnect storm is absorbed shows up while it happens.
+ *
+ **********************************************************************************************/
+
+void TCPServer::noteAccepts(unsigned int count) {
+    if (count == 0)
     {
-        case 1:
+        return;
+    }
+    accept_stats &stats = this->acceptCounters;
+    stats.accepted += count;
+    stats.batches++;
+    stats.largestBatch = std::max(stats.largestBatch, count);
+
+    int64_t nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    if (nowMs - stats.windowStartMs >= 1000)
+    {
+        if (stats.windowCount > 0)
         {
-            std::string clientIP = "Current IP: " + getClientIP(socket) + "\n\nCOMMAND:";
-            sendMessageToClient(socket, clientIP);
-            break;
+            LOG_INFO("Accepted %llu connections within one second (loop %u)", (unsigned long long)stats.windowCount, this->shardID);
+        }
+        stats.windowStartMs = nowMs;
+        stats.windowCount = 0;
+    }
+    stats.windowCount += count;
+    stats.peakPerSecond = std::max(stats.peakPerSecond, stats.windowCount);
+}
+
+//accept summary for this event loop, printed when it shuts down
+void TCPServer::printAcceptStats() {
+    const accept_stats &stats = this->acceptCounters;
+    if (stats.accepted == 0)
+    {
+        return;
+    }
+    LOG_INFO("Loop %u accepted %llu connections in %llu wakeups (largest batch %u, peak %llu/s, %llu deferred, %llu aborted)",
+             this->shardID, (unsigned long long)stats.accepted, (unsigned long long)stats.batches, stats.largestBatch,
+             (unsigned long long)stats.peakPerSecond, (unsigned long long)stats.deferred, (unsigned long long)stats.aborted);
+}
+
+/**********************************************************************************************
+ * openClient - Adds a freshly accepted socket to the connection table and greets the client.
+ *              Engine independent, the caller has already registered the socket for reads.
+ *              Returns nullptr if admission control turned the client away (socket closed).
+ *              peer is the address accept returned, or nullptr to look it up once here.
+ *
+ **********************************************************************************************/
+
+TCPConn *TCPServer::openClient(int setSocket, const struct sockaddr *peer) {
+    TCPConn *client = this->clientObj_sockets.insert(setSocket);
+    client->socketObjFD = setSocket;
+    client->serial = ++this->nextSerial;
+    this->metrics->add(MET_ACCEPTED, 1);
+
+    struct sockaddr_storage peerAddr;
+    if (peer == nullptr)
+    {
+        socklen_t addrLen = sizeof(peerAddr);
+        memset(&peerAddr, 0, sizeof(peerAddr));
+        getpeername(setSocket, reinterpret_cast<struct sockaddr *>(&peerAddr), &addrLen);
+        peer = reinterpret_cast<struct sockaddr *>(&peerAddr);
+    }
+    client->setPeer(peer);
+
+    //over the global or per-address limit: told so and closed before it costs anything more
+    if (AdmissionControl::instance().enabled() && !AdmissionControl::instance().admit(client->peerIP))
+    {
+        rejectClient(setSocket, *client);
+        return nullptr;
+    }
+
+    client->lastReadMs = this->loopNowMs;
+    client->tokens = this->commandBurst;
+    client->tokensAtMs = this->loopNowMs;
+    armTimer(*client);
+
+    //Server Admin Alert
+    LOG_INFO("New connection created: socket %d from %s port %u, %zu connected", setSocket,
+             client->peerIP.c_str(), client->peerPort, this->clientObj_sockets.size());
+
+    //with a password file the session starts at the login, the menu comes once it succeeds
+    if (this->passwords)
+    {
+        client->status = TCPConn::s_username;
+        sendText(*client, "Username: ");
+        return client;
+    }
+
+    //Welcome message and menu
+    sendReply(*client, this->responses->get(RESP_WELCOME));
+
+    //Server Admin Notification
+    LOG_DEBUG("Hello message sent to socket: %d", setSocket);
+    return client;
+}
+
+/**********************************************************************************************
+ * handleClient - Writes queued replies if the socket became writable, then reads and answers
+ *                whatever the client sent unless its reads are paused.
+ *
+ **********************************************************************************************/
+
+void TCPServer::handleClient(int currentClientFD, uint32_t events) {
+    //finds the table slot that owns this socket
+    TCPConn *client = this->clientObj_sockets.find(currentClientFD);
+    if (client == nullptr)
+    {
+        return;
+    }
+
+    if (events & EPOLLOUT)
+    {
+        flushClient(*client);
+
+        //a failed write closes the client, draining may also have resumed and closed it
+        client = this->clientObj_sockets.find(currentClientFD);
+        if (client == nullptr)
+        {
+            return;
+        }
+    }
+
+    readClient(*client, events);
+}
+
+/**********************************************************************************************
+ * readClient - Reads everything a ready client has sent, processes any complete commands and
+ *              closes the connection if the client hung up. Stops early when the replies pile
+ *              up past the high-water mark, the rest stays in the socket until resumeReading.
+ *
+ **********************************************************************************************/
+
+void TCPServer::readClient(TCPConn &client, uint32_t events) {
+    int currentClientFD = client.socketObjFD;
+    bool disconnected = false;
+    bool drained = false;
+
+    //borrows a block from the loop if the client gave its back while idle
+    client.input.attach(this->readBlocks);
+
+    //edge-triggered, so keep reading until the socket has nothing left
+    while(!client.readPaused)
+    {
+        //reads straight into the client's input buffer, no intermediate copy
+        char *readTo = client.input.writePtr(READ_CHUNK);
+        ssize_t valRead = read( currentClientFD, readTo, client.input.writable());
+        if (valRead > 0)
+        {
+            //Alerting Admin of socket message
+            LOG_DEBUG("socket %d: %.*s", currentClientFD, static_cast<int>(valRead), readTo);
+
+            client.input.commit(valRead);
+            this->metrics->add(MET_BYTES_IN, valRead);
+
+            //answers as it goes so a flood of commands can be paused before it is all buffered
+            if (!processCommands(client))
+            {
+                return;
+            }
+            continue;
         }
-        case 2:
+        if ((valRead < 0) && (errno == EINTR))
         {
-            std::string clientPort = "Current Port: " + getClientPort(socket) + "\n\nCOMMAND:";
-            sendMessageToClient(socket, clientPort);
-            break;
+            continue;
         }
-        case 3:
+        //0 means an orderly hangup, anything but EAGAIN is a dead connection
+        if ((valRead == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK)))
         {
-            sendMessageToClient(socket, "__m_OO_m__\n\nCOMMAND:");
-            break;
+            disconnected = true;
         }
-        case 4:
+        drained = true;
+        break;
+    }
+
+    //nothing left to frame, the block goes back until the client sends again
+    if (drained && !disconnected)
+    {
+        client.input.release(this->readBlocks);
+    }
+
+    if (disconnected || (events & (EPOLLHUP | EPOLLERR)))
+    {
+        //Somebody disconnected , get his details and print  
+        printDisconnectedClientInfo(currentClientFD);
+
+        //Close the socket and mark as 0 in list for reuse  
+        closeClient(currentClientFD); 
+    }
+}
+
+/**********************************************************************************************
+ * processCommands - Runs every complete (newline terminated) command waiting in a client's
+ *                   input buffer. A partial command is left in the buffer for the next read.
+ *                   Commands are views into the buffer, nothing is copied to match them.
+ *                   Returns false if a command closed the connection.
+ *
+ **********************************************************************************************/
+
+bool TCPServer::processCommands(TCPConn &client) {
+    int currentClientFD = client.socketObjFD;
+    std::string_view readCommandStr;
+
+    //pushes the idle deadline back without touching the timer, expireClients checks it lazily
+    client.lastReadMs = this->loopNowMs;
+
+    //loops continue until all complete commands in the buffer are processed
+    while(!client.readPaused)
+    {
+        //over its command rate: the rest waits, in the buffer and the socket, until tokens refill
+        if ((this->commandRate > 0) && !takeToken(client))
         {
-            sendMessageToClient(socket, "m_(-___-)_m\n\nCOMMAND:");
+            if (client.input.pending() > 0)
+            {
+                throttleClient(client);
+            }
             break;
         }
-        case 5:
+        if (!client.input.nextLine(readCommandStr))
         {
-            sendMessageToClient(socket, "d[ o_O ]b\n\nCOMMAND:");
             break;
         }
-        default:
+        if (this->commandRate > 0)
         {
-            std::string tempString(inputCommand);
-            clrNewlines(tempString);
-            std::stringstream ss;
-            ss << "Unknown Command: \"" << tempString << "\"\n\nCOMMAND:";
-            std::string unknownCmd = ss.str();
-            sendMessageToClient( socket, unknownCmd );
+            client.tokens -= 1;
         }
-    }
-}
 
+        //clear away the carriage return from telnet style clients to ensure proper match
+        while (!readCommandStr.empty() && (readCommandStr.back() == '\r'))
+        {
+            readCommandStr.remove_suffix(1);
+        }
 
-socket_obj::socket_obj(){
+        //handler returns false once it has closed the connection, nothing after that is processed
+        bool keepOpen = (client.status == TCPConn::s_menu) ? dispatchCommand(client, readCommandStr) : sessionInput(client, readCommandStr);
+        if (!keepOpen)
+        {
+            return false;
+        }
 
-}
+        //client is not reading its replies, the remaining commands wait until it catches up
+        if (!client.readPaused && (client.output.bytes() > this->highWater))
+        {
+            this->metrics->add(MET_READ_PAUSES, 1);
+            LOG_INFO("Output backlog on socket %d, pausing reads", client.socketObjFD);
+            pauseReading(client);
+            return true;
+        }
+    }
 
-socket_obj::~socket_obj(){
-    
-}
\ No newline at end of file
+    if (client.readPaused)
+    {
+        return true;
+    }
+
+    //a new partial command may bring the read deadline before the timer, finishing one clears it
+    if (client.input.pending() == 0)
+    {
+        client.partialSinceMs = 0;
+    }
+    else if (client.partialSinceMs == 0)
+    {
+        client.partialSinceMs = this->loopNowMs;
+        if (this->readTimeoutMs > 0)
+        {
+            armTimer(client);
+        }
+    }
+
+    if (client.input.pending() > 0)
+    {
+        //Alert to Server Admin
+        LOG_DEBUG("partial cmd from client: %d", currentClientFD);
+
+        //a client that never sends a newline can not make the server buffer forever
+        if (client.input.pending() > MAX_COMMAND_LENGTH)
+        {
+            client.input.clear();
+            sendReply(client, "Command too long\n\n");
+        }
+    }
+    return true;
+}
+
+/**********************************************************************************************
+ * pauseReading - Stops taking commands from a client whose replies are over the high-water
+ *                mark. The epoll engine simply skips the read, data stays in the socket.
+ *
+ **********************************************************************************************/
+
+void TCPServer::pauseReading(TCPConn &client) {
+    client.readPaused = true;
+    this->pausedClients++;
+}
+
+/**********************************************************************************************
+ * resumeReading - Continues a paused client once its output has drained: commands already
+ *                 buffered run first, then the socket is read again since no new edge will
+ *                 report the data that arrived while paused.
+ *
+ **********************************************************************************************/
+
+void TCPServer::resumeReading(TCPConn &client) {
+    unpauseReading(client);
+    if (!processCommands(client))
+    {
+        return;
+    }
+    readClient(client, 0);
+}
+
+//clears the pause, shared by every engine's resumeReading
+void TCPServer::unpauseReading(TCPConn &client) {
+    client.readPaused = false;
+    this->pausedClients--;
+    LOG_DEBUG("Output drained on socket %d, resuming reads", client.socketObjFD);
+}
+
+//republishes this loop's counters for tcpserver-stat, once per loop pass
+void TCPServer::publishStats() {
+    this->metrics->publish(this->clientObj_sockets.size(), this->pausedClients, pendingWrites());
+}
+
+//lists a client for the flush at the end of the loop pass
+void TCPServer::queueFlush(TCPConn &client) {
+    if (!client.flushQueued)
+    {
+        client.flushQueued = true;
+        this->dirtyClients.push_back(client.socketObjFD);
+    }
+}
+
+//batched prompts: the prompt held back from the queued replies goes after the last of them
+void TCPServer::finishBatch(TCPConn &client) {
+    if (client.promptOwed)
+    {
+        client.output.push(this->responses->get(RESP_PROMPT));
+        client.promptOwed = false;
+    }
+}
+
+/**********************************************************************************************
+ * flushPending - Writes out every client that got replies during this loop pass. Flushing can
+ *                resume a paused client and queue more replies, so it runs until nothing is
+ *                left to flush.
+ *
+ **********************************************************************************************/
+
+void TCPServer::flushPending() {
+    while (!this->dirtyClients.empty())
+    {
+        this->flushBatch.swap(this->dirtyClients);
+        for (int fd : this->flushBatch)
+        {
+            TCPConn *client = this->clientObj_sockets.find(fd);
+            if ((client == nullptr) || !client->flushQueued)
+            {
+                continue;
+            }
+            client->flushQueued = false;
+            flushClient(*client);
+        }
+        this->flushBatch.clear();
+    }
+}
+
+/**********************************************************************************************
+ * flushClient - Writes as much of a client's output as the socket takes. EPOLLOUT is only
+ *               subscribed while something is left over, and a paused client is resumed once
+ *               its backlog drops below half the high-water mark.
+ *
+ **********************************************************************************************/
+
+void TCPServer::flushClient(TCPConn &client) {
+    int currentClientFD = client.socketObjFD;
+    finishBatch(client);
+    ssize_t written = client.output.writeTo(currentClientFD);
+    if (written < 0)
+    {
+        printDisconnectedClientInfo(currentClientFD);
+        closeClient(currentClientFD);
+        return;
+    }
+    this->metrics->add(MET_BYTES_OUT, written);
+
+    bool pending = !client.output.empty();
+    if (pending != client.writeWatch)
+    {
+        uint32_t events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        this->eventLoop.modify(currentClientFD, pending ? (events | EPOLLOUT) : events);
+        client.writeWatch = pending;
+        if (pending)
+        {
+            this->watchedWrites++;
+        }
+        else
+        {
+            this->watchedWrites--;
+        }
+    }
+
+    if (canResume(client))
+    {
+        resumeReading(client);
+    }
+}
+
+/**********************************************************************************************
+ * shutdown - Cleanly closes the socket FD.
+ *
+ *    Throws: socket_error for recoverable errors, runtime_error for unrecoverable types
+ **********************************************************************************************/
+
+void TCPServer::shutdown() {
+    //stops the other event loops first so they are not touching their tables while closing
+    for (std::unique_ptr<TCPServer> &shard : this->shards)
+    {
+        shard->requestStop();
+    }
+    for (std::thread &shardThread : this->shardThreads)
+    {
+        shardThread.join();
+    }
+    for (std::unique_ptr<TCPServer> &shard : this->shards)
+    {
+        shard->shutdown();
+    }
+    this->shardThreads.clear();
+    this->shards.clear();
+
+    printAcceptStats();
+
+    //collects the live client sockets first since closing them changes the table
+    std::vector<int> openFDs;
+    this->clientObj_sockets.forEach([&openFDs](int fd, TCPConn &) { openFDs.push_back(fd); });
+
+    //closes the client sockets
+    for (int fd : openFDs){
+        closeClient(fd);
+    }
+    //closes server client
+    close(this->socket_FD);
+}
+
+void TCPServer::closeClient(int inputClientFD){
+    //slot was never used or was already closed
+    if (inputClientFD <= 0)
+    {
+        return;
+    }
+    LOG_DEBUG("Closing client socket: %d", inputClientFD);
+    //last replies (the exit goodbye included) get one chance to go out
+    TCPConn *client = this->clientObj_sockets.find(inputClientFD);
+    if (client != nullptr)
+    {
+        ssize_t written = client->output.writeTo(inputClientFD);
+        if (written > 0)
+        {
+            this->metrics->add(MET_BYTES_OUT, written);
+        }
+        this->metrics->add(MET_CLOSED, 1);
+        if (client->readPaused)
+        {
+            this->pausedClients--;
+        }
+        if (client->writeWatch)
+        {
+            this->watchedWrites--;
+        }
+        if (AdmissionControl::instance().enabled())
+        {
+            AdmissionControl::instance().release(client->peerIP);
+        }
+        client->clearSecrets();
+    }
+    this->timers.cancel(inputClientFD);
+    //a freed fd lets connections left queued at the fd limit in, retried at the end of this pass
+    if (this->acceptDeferred)
+    {
+        this->acceptRetryMs = 0;
+    }
+    //stops watching the socket before the fd number can be reused
+    this->eventLoop.remove(inputClientFD);
+    //closes client
+    close( inputClientFD );   
+    //frees the table slot for reuse
+    this->clientObj_sockets.remove(inputClientFD);
+}
+
+/**********************************************************************************************
+ * clientDeadline - When the client's timer is next due: the earliest of its idle and read
+ *                  deadlines and the end of its throttling, INT64_MAX if none applies.
+ *
+ **********************************************************************************************/
+
+int64_t TCPServer::clientDeadline(const TCPConn &client) const {
+    int64_t deadline = INT64_MAX;
+    if (this->idleTimeoutMs > 0)
+    {
+        deadline = client.lastReadMs + this->idleTimeoutMs;
+    }
+    if ((this->readTimeoutMs > 0) && (client.partialSinceMs != 0))
+    {
+        deadline = std::min(deadline, client.partialSinceMs + this->readTimeoutMs);
+    }
+    if (client.throttled)
+    {
+        deadline = std::min(deadline, client.throttledUntilMs);
+    }
+    return deadline;
+}
+
+//(re)schedules the client's timer at its current deadline
+void TCPServer::armTimer(TCPConn &client) {
+    int64_t deadline = clientDeadline(client);
+    if (deadline != INT64_MAX)
+    {
+        this->timers.schedule(client.socketObjFD, deadline);
+    }
+}
+
+/**********************************************************************************************
+ * expireClients - Advances the timer wheel to the loop time and deals with every timer that
+ *                 came due in one batch: throttled clients are resumed, timed out ones closed.
+ *                 Reads only move a client's deadline, not its timer, so a timer that fires
+ *                 early for a client that has been active since is simply set again for the
+ *                 real deadline.
+ *
+ **********************************************************************************************/
+
+void TCPServer::expireClients() {
+    if (this->timers.size() == 0)
+    {
+        return;
+    }
+    this->expiredClients.clear();
+    this->timers.advance(this->loopNowMs, this->expiredClients);
+
+    unsigned int closed = 0;
+    for (int fd : this->expiredClients)
+    {
+        TCPConn *client = this->clientObj_sockets.find(fd);
+        if (client == nullptr)
+        {
+            continue;
+        }
+
+        //throttling is over, the client picks up where it stopped (and may close or throttle again)
+        if (client->throttled && (client->throttledUntilMs <= this->loopNowMs))
+        {
+            client->throttled = false;
+            if (canResume(*client))
+            {
+                resumeReading(*client);
+                client = this->clientObj_sockets.find(fd);
+                if (client == nullptr)
+                {
+                    continue;
+                }
+            }
+        }
+
+        int64_t deadline = clientDeadline(*client);
+        if (deadline > this->loopNowMs)
+        {
+            armTimer(*client);
+            continue;
+        }
+
+        LOG_INFO("Timing out socket %d from %s port %u (%s)", fd, client->peerIP.c_str(), client->peerPort,
+                 (client->partialSinceMs != 0) ? "unfinished command" : "idle");
+        client->output.push(std::string_view("Connection timed out\n"));
+        closeClient(fd);
+        closed++;
+    }
+    if (closed > 0)
+    {
+        this->metrics->add(MET_TIMEOUTS, closed);
+        LOG_INFO("Closed %u timed out connections, %zu connected", closed, this->clientObj_sockets.size());
+    }
+}
+
+/**********************************************************************************************
+ * rejectClient - Turns away a client over the admission limits: a short busy message (best
+ *                effort, the socket is fresh so it fits), then the socket is closed before it
+ *                was ever read.
+ *
+ **********************************************************************************************/
+
+void TCPServer::rejectClient(int setSocket, TCPConn &client) {
+    static const char busy[] = "Server busy, try again later\n";
+    LOG_INFO("Rejecting connection from %s port %u, connection limit reached", client.peerIP.c_str(), client.peerPort);
+    send(setSocket, busy, sizeof(busy) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+    this->metrics->add(MET_REJECTED, 1);
+    this->metrics->add(MET_CLOSED, 1);
+    this->clientObj_sockets.remove(setSocket);
+    close(setSocket);
+}
+
+//refills the client's bucket up to the loop time, true if a whole command's token is there
+bool TCPServer::takeToken(TCPConn &client) {
+    if (client.tokens < 1)
+    {
+        int64_t elapsedMs = this->loopNowMs - client.tokensAtMs;
+        if (elapsedMs > 0)
+        {
+            client.tokens = std::min(this->commandBurst, client.tokens + (elapsedMs * this->commandRate) / 1000.0);
+            client.tokensAtMs = this->loopNowMs;
+        }
+    }
+    return client.tokens >= 1;
+}
+
+/**********************************************************************************************
+ * throttleClient - Stops reading a client that is out of tokens until the next one is due.
+ *                  Unread commands stay in the kernel, so TCP flow control slows the client
+ *                  down instead of the loop spending time on it.
+ *
+ **********************************************************************************************/
+
+void TCPServer::throttleClient(TCPConn &client) {
+    int64_t waitMs = static_cast<int64_t>(((1 - client.tokens) * 1000.0) / this->commandRate) + 1;
+    client.throttled = true;
+    client.throttledUntilMs = this->loopNowMs + waitMs;
+    this->metrics->add(MET_THROTTLED, 1);
+    LOG_DEBUG("Socket %d over its command rate, reads deferred %lld ms", client.socketObjFD, (long long)waitMs);
+    pauseReading(client);
+    armTimer(client);
+}
+
+/**********************************************************************************************
+ * offload - Hands work to the worker pool; its result comes back through drainCompletions
+ *           and is dealt with by finishWork according to kind. Reads stay paused until then
+ *           so the commands after it are answered in order. Without a pool the work just
+ *           runs here, and a full pool answers busy instead of queueing. Returns false if
+ *           the client was closed.
+ *
+ **********************************************************************************************/
+
+bool TCPServer::offload(TCPConn &client, WorkKind kind, std::function<std::string()> work) {
+    if (!WorkerPool::instance().running())
+    {
+        work_item item;
+        item.kind = kind;
+        item.work = std::move(work);
+        WorkerPool::execute(item);
+        return finishWork(client, item);
+    }
+
+    work_item *item = new work_item;
+    item->work = std::move(work);
+    item->kind = kind;
+    item->owner = &this->completions;
+    item->fd = client.socketObjFD;
+    item->serial = client.serial;
+    if (!WorkerPool::instance().submit(item))
+    {
+        LOG_INFO("Worker pool full, turning away a command from socket %d", client.socketObjFD);
+        item->result = "Server busy, try again later\n\n";
+        bool keepOpen = finishWork(client, *item);
+        delete item;
+        return keepOpen;
+    }
+
+    client.awaitingWork = true;
+    pauseReading(client);
+    return true;
+}
+
+/**********************************************************************************************
+ * finishWork - Acts on a result for its client: a user name check asks for the password or
+ *              turns the client away, a password check completes or fails the login
+ *              (closing the client after max_attempts failures), anything else is the
+ *              command's reply. Returns false if the client was closed.
+ *
+ **********************************************************************************************/
+
+bool TCPServer::finishWork(TCPConn &client, work_item &item) {
+    if (item.kind == WORK_REPLY)
+    {
+        sendReply(client, item.result);
+        return true;
+    }
+
+    if (item.kind == WORK_USERNAME)
+    {
+        if (item.result == login_ok)
+        {
+            client.status = TCPConn::s_passwd;
+            sendText(client, "Password: ");
+            return true;
+        }
+        if (item.result == login_failed)
+        {
+            return unknownUser(client);
+        }
+        //busy, the name may be tried again
+        sendText(client, item.result);
+        sendText(client, "Username: ");
+        return true;
+    }
+
+    std::string_view user = client.user();
+    if (item.result == login_ok)
+    {
+        LOG_INFO("User %.*s logged in from %s", static_cast<int>(user.size()), user.data(), client.peerIP.c_str());
+        loggedIn(client);
+        return true;
+    }
+
+    //busy or broken is not the client's fault and does not count as an attempt
+    if (item.result == login_failed)
+    {
+        LOG_INFO("Wrong password for %.*s from %s", static_cast<int>(user.size()), user.data(), client.peerIP.c_str());
+        if (++client.pwdAttempts >= max_attempts)
+        {
+            client.output.push(std::string_view("Password incorrect, disconnecting\n"));
+            closeClient(client.socketObjFD);
+            return false;
+        }
+        sendText(client, "Password incorrect\nPassword: ");
+        return true;
+    }
+    sendText(client, item.result);
+    sendText(client, "Password: ");
+    return true;
+}
+
+/**********************************************************************************************
+ * drainCompletions - Deals with the results the worker pool finished for this loop and lets
+ *                    their clients continue with the commands they sent meanwhile. Results
+ *                    for a client that has gone (its fd may be someone else's by now) are
+ *                    dropped.
+ *
+ **********************************************************************************************/
+
+void TCPServer::drainCompletions() {
+    work_item *item = this->completions.takeAll();
+    while (item != nullptr)
+    {
+        work_item *next = item->next;
+        TCPConn *client = this->clientObj_sockets.find(item->fd);
+        if ((client != nullptr) && (client->serial == item->serial) && client->awaitingWork)
+        {
+            client->awaitingWork = false;
+            if (finishWork(*client, *item) && canResume(*client))
+            {
+                resumeReading(*client);
+            }
+        }
+        delete item;
+        item = next;
+    }
+}
+
+//epoll timeout for the next pass: until the wheel's next timer or a deferred accept retry,
+//-1 (forever) if neither is set
+int TCPServer::nextWaitMs() const {
+    int64_t nowMs = monotonicMs();
+    int waitMs = this->timers.nextTimeoutMs(nowMs);
+    if (this->acceptDeferred)
+    {
+        int retryMs = (this->acceptRetryMs > nowMs) ? static_cast<int>(this->acceptRetryMs - nowMs) : 0;
+        if ((waitMs < 0) || (retryMs < waitMs))
+        {
+            waitMs = retryMs;
+        }
+    }
+    return waitMs;
+}
+
+int64_t TCPServer::monotonicMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<int64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+//Throws error if input < 0
+void TCPServer::errorCheck(int input, std::string errMess){
+    if (input < 0)
+    {
+        throw socket_error(errMess);
+    }
+}
+
+/**********************************************************************************************
+ * sendMessageToClient - Queues a reply on the client's output. Nothing is written here, every
+ *                       reply of the loop pass goes out together when the client is flushed.
+ *
+ **********************************************************************************************/
+
+void TCPServer::sendMessageToClient(int inputClientFD, std::string_view message){
+    TCPConn *client = this->clientObj_sockets.find(inputClientFD);
+    if (client == nullptr)
+    {
+        return;
+    }
+    client->output.push(message);
+    queueFlush(*client);
+}
+
+/**********************************************************************************************
+ * sendReply - Queues a command reply followed by the prompt. A pre-built Payload already ends
+ *             with the prompt and is queued by reference; body text is given without it. When
+ *             prompts are batched the prompt is left off here and added once by finishBatch.
+ *
+ **********************************************************************************************/
+
+void TCPServer::sendReply(TCPConn &client, const Payload &payload){
+    if (this->batchPrompt)
+    {
+        client.output.push(payload, this->responses->get(RESP_PROMPT)->size());
+        client.promptOwed = true;
+    }
+    else
+    {
+        client.output.push(payload);
+    }
+    queueFlush(client);
+}
+
+void TCPServer::sendReply(TCPConn &client, std::string_view body){
+    client.output.push(body);
+    if (this->batchPrompt)
+    {
+        client.promptOwed = true;
+    }
+    else
+    {
+        client.output.push(this->responses->get(RESP_PROMPT));
+    }
+    queueFlush(client);
+}
+
+//Return the Client IP in a string, as captured at accept
+std::string TCPServer::getClientIP(const int inputFD)
+{
+    TCPConn *client = this->clientObj_sockets.find(inputFD);
+    return (client != nullptr) ? client->peerIP : std::string();
+}
+
+//Displays disconnect info to console
+void TCPServer::printDisconnectedClientInfo(const int inputFD)
+{
+    TCPConn *client = this->clientObj_sockets.find(inputFD);
+    if (client == nullptr)
+    {
+        return;
+    }
+    LOG_INFO("Client disconnected , ip %s, port %u", client->peerIP.c_str(), client->peerPort);
+}
+
+//Return the Client Port in a string, as captured at accept
+std::string TCPServer::getClientPort(const int inputFD)
+{
+    TCPConn *client = this->clientObj_sockets.find(inputFD);
+    return (client != nullptr) ? std::to_string(client->peerPort) : std::string();
+}
+
+/**********************************************************************************************
+ * Command registry - one line per command. The table is hashed at compile time, so adding a
+ *                    command never makes dispatch slower.
+ *
+ **********************************************************************************************/
+
+struct CommandRegistry
+{
+    static constexpr std::array<CommandEntry<TCPServer::CommandHandler>, 11> entries = {{
+        {"hello",  &TCPServer::cmdHello},
+        {"exit",   &TCPServer::cmdExit},
+        {"passwd", &TCPServer::cmdPasswd},
+        {"menu",   &TCPServer::cmdMenu},
+        {"1",      &TCPServer::cmdClientIP},
+        {"2",      &TCPServer::cmdClientPort},
+        {"3",      &TCPServer::cmdGraphic1},
+        {"4",      &TCPServer::cmdGraphic2},
+        {"5",      &TCPServer::cmdGraphic3},
+        {"stats",  &TCPServer::cmdStats},
+        {"resume", &TCPServer::cmdResume, true},
+    }};
+
+    static constexpr CommandTable<TCPServer::CommandHandler, entries.size()> table{entries};
+    static_assert(table.isValid(), "command registered twice");
+    static_assert(entries.size() < METRIC_MAX_COMMANDS, "more commands than metric slots");
+};
+
+//labels the per-command metrics with the registered names
+static void nameCommandMetrics() {
+    for (size_t i = 0; i < CommandRegistry::entries.size(); i++)
+    {
+        Metrics::instance().nameCommand(i, CommandRegistry::entries[i].name);
+    }
+}
+
+/**********************************************************************************************
+ * dispatchCommand - Splits the command token from its arguments and runs the registered
+ *                   handler, or reports an unknown command. Returns false if the handler
+ *                   closed the connection. The time spent goes into the command's histogram.
+ *
+ **********************************************************************************************/
+
+bool TCPServer::dispatchCommand(TCPConn &client, std::string_view readCommand) {
+    std::string_view token = readCommand;
+    std::string_view args;
+    size_t space = readCommand.find(' ');
+    if (space != std::string_view::npos)
+    {
+        token = readCommand.substr(0, space);
+        args = readCommand.substr(space + 1);
+    }
+
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    unsigned int metricID = METRIC_MAX_COMMANDS - 1;
+    bool keepOpen;
+
+    const CommandEntry<CommandHandler> *entry = CommandRegistry::table.find(token);
+    if ((entry == nullptr) || (!entry->acceptsArgs && (space != std::string_view::npos)))
+    {
+        keepOpen = unknownCommand(client, readCommand);
+    }
+    else
+    {
+        metricID = entry->id;
+        keepOpen = (this->*(entry->handler))(client, args);
+    }
+
+    this->metrics->recordCommand(metricID, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count());
+    return keepOpen;
+}
+
+//Sends Hello message
+bool TCPServer::cmdHello(TCPConn &client, std::string_view) {
+    sendReply(client, this->responses->get(RESP_HELLO));
+    return true;
+}
+
+//closes client's connection
+bool TCPServer::cmdExit(TCPConn &client, std::string_view) {
+    closeClient(client.socketObjFD);
+    return false;
+}
+
+//starts a password change, the new password is asked for twice. Without a password file there is nothing to change
+bool TCPServer::cmdPasswd(TCPConn &client, std::string_view) {
+    if (!this->passwords)
+    {
+        sendReply(client, this->responses->get(RESP_PASSWD));
+        return true;
+    }
+    client.status = TCPConn::s_changepwd;
+    sendText(client, "New Password: ");
+    return true;
+}
+
+/**********************************************************************************************
+ * cmdResume - Logs a client in with a session ticket instead of a password, at the username
+ *             prompt. A bad ticket counts as a failed attempt like a wrong password does.
+ *             Returns false if the client was closed.
+ *
+ **********************************************************************************************/
+
+bool TCPServer::cmdResume(TCPConn &client, std::string_view args) {
+    if (!this->passwords || !SessionTickets::instance().enabled())
+    {
+        sendReply(client, "Session tickets are not enabled on this server\n\n");
+        return true;
+    }
+    if (client.status != TCPConn::s_username)
+    {
+        sendReply(client, "Already logged in\n\n");
+        return true;
+    }
+
+    std::string user;
+    if (SessionTickets::instance().redeem(args, this->loopNowMs, user))
+    {
+        LOG_INFO("User %s resumed a session from %s", user.c_str(), client.peerIP.c_str());
+        client.setUser(user);
+        loggedIn(client);
+        return true;
+    }
+
+    LOG_INFO("Invalid session ticket from %s", client.peerIP.c_str());
+    if (++client.pwdAttempts >= max_attempts)
+    {
+        client.output.push(std::string_view("Session ticket not valid, disconnecting\n"));
+        closeClient(client.socketObjFD);
+        return false;
+    }
+    sendText(client, "Session ticket not valid\nUsername: ");
+    return true;
+}
+
+/**********************************************************************************************
+ * sessionInput - Handles a line in any state but s_menu: the login steps and the two entries
+ *                of a password change. Names are looked up in the store's index right here;
+ *                a miss, which has to check the file for users added since, and password
+ *                hashing go to the worker pool. Returns false if the client was closed.
+ *
+ **********************************************************************************************/
+
+bool TCPServer::sessionInput(TCPConn &client, std::string_view line) {
+    std::shared_ptr<PasswdMgr> store = this->passwords;
+    switch (client.status)
+    {
+    case TCPConn::s_username:
+    {
+        //a returning client may skip the password with the ticket from its last login
+        if (SessionTickets::instance().enabled() && (line.substr(0, 7) == "resume "))
+        {
+            return dispatchCommand(client, line);
+        }
+
+        //names the store would never take are unknown without asking it
+        if (!PasswdMgr::validName(line.data(), line.size()))
+        {
+            return unknownUser(client);
+        }
+        //NUL terminated copy for the store
+        char name[PASSWD_MAX_NAME + 1];
+        memcpy(name, line.data(), line.size());
+        name[line.size()] = '\0';
+        client.setUser(line);
+        if (store->knownUser(name))
+        {
+            client.status = TCPConn::s_passwd;
+            sendText(client, "Password: ");
+            return true;
+        }
+
+        //the store may have to re-read the file and wait for a writer's sync, not on the loop
+        std::string user(line);
+        return offload(client, WORK_USERNAME, [store, user]() {
+            return std::string(store->checkUser(user.c_str()) ? login_ok : login_failed);
+        });
+    }
+
+    case TCPConn::s_passwd:
+    {
+        std::string user(client.user());
+        std::shared_ptr<secret_buffer> passwd = std::make_shared<secret_buffer>(line);
+        return offload(client, WORK_LOGIN, [store, user, passwd]() {
+            bool matched = store->checkPasswd(user.c_str(), passwd->c_str());
+            passwd->wipe();
+            return std::string(matched ? login_ok : login_failed);
+        });
+    }
+
+    case TCPConn::s_changepwd:
+        client.keepNewPasswd(line);
+        client.status = TCPConn::s_confirmpwd;
+        sendText(client, "Enter the password again: ");
+        return true;
+
+    case TCPConn::s_confirmpwd:
+    {
+        bool match = (line == client.newPasswd);
+        std::shared_ptr<secret_buffer> passwd = std::make_shared<secret_buffer>(client.newPasswd);
+        client.clearSecrets();
+        client.status = TCPConn::s_menu;
+        if (!match)
+        {
+            sendReply(client, "Passwords do not match, password unchanged\n\n");
+            return true;
+        }
+        std::string user(client.user());
+        return offload(client, WORK_REPLY, [store, user, passwd]() {
+            bool changed = store->changePasswd(user.c_str(), passwd->c_str());
+            passwd->wipe();
+            if (!changed)
+            {
+                return std::string("Password change failed\n\n");
+            }
+            SessionTickets::instance().revoke(user);
+            return std::string("Password changed\n\n");
+        });
+    }
+
+    default:
+        return dispatchCommand(client, line);
+    }
+}
+
+//turns away a client whose user name is not in the store, returns false as it is closed
+bool TCPServer::unknownUser(TCPConn &client) {
+    LOG_INFO("Unknown user from %s, disconnecting", client.peerIP.c_str());
+    client.output.push(std::string_view("Username not recognized\n"));
+    closeClient(client.socketObjFD);
+    return false;
+}
+
+/**********************************************************************************************
+ * loggedIn - Takes a client whose login just succeeded to the menu. With session tickets on
+ *            it is first given a ticket to log in with next time instead of its password.
+ *
+ **********************************************************************************************/
+
+void TCPServer::loggedIn(TCPConn &client) {
+    client.status = TCPConn::s_menu;
+    client.pwdAttempts = 0;
+    std::string ticket = SessionTickets::instance().issue(client.user(), this->loopNowMs);
+    if (!ticket.empty())
+    {
+        sendText(client, "Session ticket: " + ticket + "\n");
+    }
+    sendReply(client, this->responses->get(RESP_WELCOME));
+}
+
+//queues text that is not a command reply (login prompts), so it goes out without the command prompt
+void TCPServer::sendText(TCPConn &client, std::string_view text) {
+    finishBatch(client);
+    client.output.push(text);
+    queueFlush(client);
+}
+
+//Displays menu
+bool TCPServer::cmdMenu(TCPConn &client, std::string_view) {
+    sendReply(client, this->responses->get(RESP_MENU));
+    return true;
+}
+
+bool TCPServer::cmdClientIP(TCPConn &client, std::string_view) {
+    std::string clientIP = "Current IP: " + client.peerIP + "\n\n";
+    sendReply(client, clientIP);
+    return true;
+}
+
+bool TCPServer::cmdClientPort(TCPConn &client, std::string_view) {
+    std::string clientPort = "Current Port: " + std::to_string(client.peerPort) + "\n\n";
+    sendReply(client, clientPort);
+    return true;
+}
+
+bool TCPServer::cmdGraphic1(TCPConn &client, std::string_view) {
+    sendReply(client, this->responses->get(RESP_GRAPHIC1));
+    return true;
+}
+
+bool TCPServer::cmdGraphic2(TCPConn &client, std::string_view) {
+    sendReply(client, this->responses->get(RESP_GRAPHIC2));
+    return true;
+}
+
+bool TCPServer::cmdGraphic3(TCPConn &client, std::string_view) {
+    sendReply(client, this->responses->get(RESP_GRAPHIC3));
+    return true;
+}
+
+//Sends the merged server metrics
+bool TCPServer::cmdStats(TCPConn &client, std::string_view) {
+    std::string report = Metrics::instance().report();
+    report.append("\n");
+    sendReply(client, report);
+    return true;
+}
+
+//If command is not matched, unknown command message is sent to client 
+bool TCPServer::unknownCommand(TCPConn &client, std::string_view readCommand) {
+    std::string unknownCmd;
+    unknownCmd.reserve(readCommand.size() + 32);
+    unknownCmd.append("Unknown Command: \"").append(readCommand).append("\"\n\n");
+    sendReply(client, unknownCmd);
+    return true;
+}
@@ -0,0 +1,739 @@
+#include "config.h"
+#include "TCPUringServer.h"
+
+//STL
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+
+//networking headers
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#endif
+
+#include "exceptions.h"
+#include "Logger.h"
+
+//ring sizes, the completion ring is larger since multishot requests post many completions each
+#define RING_ENTRIES 1024
+#define CQ_ENTRIES 8192
+
+//provided buffers handed to multishot recv, count must be a power of 2
+#define RECV_BUF_COUNT 1024
+#define RECV_BUF_SIZE 2048
+#define RECV_BUF_GROUP 0
+
+//what a completion belongs to, stored in the top bits of user_data
+#define OP_CANCEL 0ULL
+#define OP_ACCEPT 1ULL
+#define OP_RECV 2ULL
+#define OP_SEND 3ULL
+#define OP_WAKE 4ULL
+
+//user_data layout: op (3 bits) | generation (29 bits) | fd (32 bits)
+static inline uint64_t packUserData(uint64_t op, uint32_t generation, int fd) {
+    return (op << 61) | ((static_cast<uint64_t>(generation) & 0x1fffffffULL) << 32) | static_cast<uint32_t>(fd);
+}
+
+TCPUringServer::TCPUringServer() {
+}
+
+TCPUringServer::~TCPUringServer() {
+    teardownRing();
+}
+
+//shards run the same engine as the server that spawned them
+std::unique_ptr<TCPServer> TCPUringServer::newShard() {
+    return std::make_unique<TCPUringServer>();
+}
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+//entry i of a provided buffer ring. Indexed by hand because the uapi flexible array member
+//picks up a padding member when compiled as C++ and no longer starts at offset 0
+static inline struct io_uring_buf *ringEntry(struct io_uring_buf_ring *ring, unsigned i) {
+    return reinterpret_cast<struct io_uring_buf *>(ring) + i;
+}
+
+/**********************************************************************************************
+ * isSupported - Multishot recv needs Linux 6.0 (provided buffer rings and multishot accept
+ *               arrived in 5.19), and io_uring can also be disabled by sysctl or seccomp, so
+ *               both the version and an actual setup call are checked.
+ *
+ **********************************************************************************************/
+
+bool TCPUringServer::isSupported() {
+    struct utsname name;
+    if (uname(&name) != 0)
+    {
+        return false;
+    }
+    if (atoi(name.release) < 6)
+    {
+        return false;
+    }
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, 2, &params);
+    if (fd < 0)
+    {
+        return false;
+    }
+    close(fd);
+    return (params.features & IORING_FEAT_SINGLE_MMAP) && (params.features & IORING_FEAT_NODROP) && (params.features & IORING_FEAT_EXT_ARG);
+}
+
+/**********************************************************************************************
+ * setupRing - Creates the io_uring instance, maps its rings and registers the provided buffer
+ *             ring for recv. Returns false (with everything released) if any step is refused.
+ *
+ **********************************************************************************************/
+
+bool TCPUringServer::setupRing() {
+    if (!isSupported())
+    {
+        return false;
+    }
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = CQ_ENTRIES;
+    this->ring_FD = syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+    if (this->ring_FD < 0)
+    {
+        return false;
+    }
+
+    //single mmap feature means the submission and completion rings share one mapping
+    this->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (cqRingSize > this->sqRingSize)
+    {
+        this->sqRingSize = cqRingSize;
+    }
+    this->sqRingPtr = mmap(NULL, this->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ring_FD, IORING_OFF_SQ_RING);
+    if (this->sqRingPtr == MAP_FAILED)
+    {
+        this->sqRingPtr = nullptr;
+        teardownRing();
+        return false;
+    }
+    this->cqRingPtr = this->sqRingPtr;
+
+    this->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqePtr = mmap(NULL, this->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ring_FD, IORING_OFF_SQES);
+    if (sqePtr == MAP_FAILED)
+    {
+        teardownRing();
+        return false;
+    }
+    this->sqes = static_cast<struct io_uring_sqe *>(sqePtr);
+
+    char *sqBase = static_cast<char *>(this->sqRingPtr);
+    this->sqHead = reinterpret_cast<unsigned *>(sqBase + params.sq_off.head);
+    this->sqTail = reinterpret_cast<unsigned *>(sqBase + params.sq_off.tail);
+    this->sqMask = reinterpret_cast<unsigned *>(sqBase + params.sq_off.ring_mask);
+    this->sqArray = reinterpret_cast<unsigned *>(sqBase + params.sq_off.array);
+    this->sqEntries = params.sq_entries;
+    this->sqLocalTail = *this->sqTail;
+    this->sqSubmitted = this->sqLocalTail;
+
+    char *cqBase = static_cast<char *>(this->cqRingPtr);
+    this->cqHead = reinterpret_cast<unsigned *>(cqBase + params.cq_off.head);
+    this->cqTail = reinterpret_cast<unsigned *>(cqBase + params.cq_off.tail);
+    this->cqMask = reinterpret_cast<unsigned *>(cqBase + params.cq_off.ring_mask);
+    this->cqes = reinterpret_cast<struct io_uring_cqe *>(cqBase + params.cq_off.cqes);
+
+    //provided buffer ring, must be page aligned so it comes from mmap
+    this->bufRingSize = RECV_BUF_COUNT * sizeof(struct io_uring_buf);
+    void *ringMem = mmap(NULL, this->bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ringMem == MAP_FAILED)
+    {
+        teardownRing();
+        return false;
+    }
+    this->bufRing = static_cast<struct io_uring_buf_ring *>(ringMem);
+    this->bufPool = static_cast<char *>(malloc(RECV_BUF_COUNT * RECV_BUF_SIZE));
+    if (this->bufPool == nullptr)
+    {
+        teardownRing();
+        return false;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(this->bufRing);
+    reg.ring_entries = RECV_BUF_COUNT;
+    reg.bgid = RECV_BUF_GROUP;
+    if (syscall(__NR_io_uring_register, this->ring_FD, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        munmap(this->bufRing, this->bufRingSize);
+        this->bufRing = nullptr;
+        teardownRing();
+        return false;
+    }
+
+    //hands every buffer to the kernel
+    this->bufMask = RECV_BUF_COUNT - 1;
+    this->bufTail = 0;
+    for (unsigned i = 0; i < RECV_BUF_COUNT; i++)
+    {
+        struct io_uring_buf *buf = ringEntry(this->bufRing, i);
+        buf->addr = reinterpret_cast<uint64_t>(this->bufPool + (i * RECV_BUF_SIZE));
+        buf->len = RECV_BUF_SIZE;
+        buf->bid = static_cast<uint16_t>(i);
+    }
+    this->bufTail = RECV_BUF_COUNT;
+    __atomic_store_n(&this->bufRing->tail, this->bufTail, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+//releases everything setupRing created, safe to call on a partly built ring
+void TCPUringServer::teardownRing() {
+    if (this->bufRing != nullptr)
+    {
+        munmap(this->bufRing, this->bufRingSize);
+        this->bufRing = nullptr;
+    }
+    free(this->bufPool);
+    this->bufPool = nullptr;
+    if (this->sqes != nullptr)
+    {
+        munmap(this->sqes, this->sqesSize);
+        this->sqes = nullptr;
+    }
+    if (this->sqRingPtr != nullptr)
+    {
+        munmap(this->sqRingPtr, this->sqRingSize);
+        this->sqRingPtr = nullptr;
+        this->cqRingPtr = nullptr;
+    }
+    if (this->ring_FD >= 0)
+    {
+        close(this->ring_FD);
+        this->ring_FD = -1;
+    }
+}
+
+/**********************************************************************************************
+ * getSQE - Returns the next free submission entry, zeroed. If the ring is full the pending
+ *          entries are submitted first to make room.
+ *
+ *    Throws: socket_error if the kernel refuses the submission
+ **********************************************************************************************/
+
+struct io_uring_sqe *TCPUringServer::getSQE() {
+    unsigned head = __atomic_load_n(this->sqHead, __ATOMIC_ACQUIRE);
+    if (this->sqLocalTail - head >= this->sqEntries)
+    {
+        submitAndWait(0);
+        head = __atomic_load_n(this->sqHead, __ATOMIC_ACQUIRE);
+        if (this->sqLocalTail - head >= this->sqEntries)
+        {
+            throw socket_error("io_uring submission ring full");
+        }
+    }
+    unsigned index = this->sqLocalTail & *this->sqMask;
+    struct io_uring_sqe *sqe = &this->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    this->sqArray[index] = index;
+    this->sqLocalTail++;
+    return sqe;
+}
+
+/**********************************************************************************************
+ * submitAndWait - Publishes every entry prepared since the last call and, if waitFor is not 0,
+ *                 sleeps until that many completions are ready or timeoutMs passes (-1 for
+ *                 no timeout). One syscall either way.
+ *
+ *    Throws: socket_error if io_uring_enter fails for any reason other than EINTR
+ **********************************************************************************************/
+
+int TCPUringServer::submitAndWait(unsigned int waitFor, int timeoutMs) {
+    __atomic_store_n(this->sqTail, this->sqLocalTail, __ATOMIC_RELEASE);
+    unsigned toSubmit = this->sqLocalTail - this->sqSubmitted;
+    unsigned flags = (waitFor > 0) ? IORING_ENTER_GETEVENTS : 0;
+
+    //the timeout rides along in the extended argument, no timeout SQE needed
+    struct __kernel_timespec timeout;
+    struct io_uring_getevents_arg waitArg;
+    const void *arg = NULL;
+    size_t argSize = 0;
+    if ((waitFor > 0) && (timeoutMs >= 0))
+    {
+        timeout.tv_sec = timeoutMs / 1000;
+        timeout.tv_nsec = static_cast<long long>(timeoutMs % 1000) * 1000000;
+        memset(&waitArg, 0, sizeof(waitArg));
+        waitArg.ts = reinterpret_cast<uint64_t>(&timeout);
+        arg = &waitArg;
+        argSize = sizeof(waitArg);
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+
+    int ret = syscall(__NR_io_uring_enter, this->ring_FD, toSubmit, waitFor, flags, arg, argSize);
+    if (ret < 0)
+    {
+        if ((errno == EINTR) || (errno == EBUSY) || (errno == EAGAIN) || (errno == ETIME))
+        {
+            return 0;
+        }
+        throw socket_error("io_uring_enter failed");
+    }
+    this->sqSubmitted += ret;
+    return ret;
+}
+
+//multishot poll on the worker pool's completion eventfd, one completion per wakeup
+void TCPUringServer::armWake() {
+    struct io_uring_sqe *sqe = getSQE();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = this->completions.fd();
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = packUserData(OP_WAKE, 0, this->completions.fd());
+}
+
+//keeps one multishot accept armed on the server socket
+void TCPUringServer::armAccept() {
+    struct io_uring_sqe *sqe = getSQE();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = this->socket_FD;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = packUserData(OP_ACCEPT, 0, this->socket_FD);
+    this->acceptArmed = true;
+}
+
+//multishot recv that keeps posting completions with a buffer from the provided ring
+void TCPUringServer::armRecv(int fd) {
+    struct io_uring_sqe *sqe = getSQE();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RECV_BUF_GROUP;
+    uring_conn &state = connState(fd);
+    sqe->user_data = packUserData(OP_RECV, state.generation, fd);
+    state.recvArmed = true;
+}
+
+//stops a client's multishot recv, its final completion arrives with -ECANCELED
+void TCPUringServer::cancelRecv(int fd) {
+    uring_conn &state = connState(fd);
+    struct io_uring_sqe *sqe = getSQE();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = packUserData(OP_RECV, state.generation, fd);
+    sqe->user_data = packUserData(OP_CANCEL, state.generation, fd);
+}
+
+//gives a consumed recv buffer back to the kernel
+void TCPUringServer::recycleBuffer(uint16_t bid) {
+    struct io_uring_buf *buf = ringEntry(this->bufRing, this->bufTail & this->bufMask);
+    buf->addr = reinterpret_cast<uint64_t>(this->bufPool + (static_cast<size_t>(bid) * RECV_BUF_SIZE));
+    buf->len = RECV_BUF_SIZE;
+    buf->bid = bid;
+    this->bufTail++;
+    __atomic_store_n(&this->bufRing->tail, this->bufTail, __ATOMIC_RELEASE);
+}
+
+/**********************************************************************************************
+ * listenSvr - io_uring event loop. Each pass queues the sends collected while handling the
+ *             previous completions, submits them together with any re-armed requests, waits
+ *             for at least one completion and then reaps everything that is ready.
+ *
+ *    Throws: socket_error for recoverable errors, runtime_error for unrecoverable types
+ **********************************************************************************************/
+
+void TCPUringServer::listenSvr() {
+    if (!setupRing())
+    {
+        LOG_WARN("io_uring not available, falling back to epoll");
+        TCPServer::listenSvr();
+        return;
+    }
+
+    //puts the socket in listening mode and starts any extra shards
+    prepareListen();
+
+    armAccept();
+    armWake();
+    this->loopNowMs = monotonicMs();
+    this->timers.advance(this->loopNowMs, this->expiredClients);
+
+    while(!this->stopRequested.load(std::memory_order_relaxed))
+    {
+        flushSends();
+        submitAndWait(1, nextWaitMs());
+        this->loopNowMs = monotonicMs();
+
+        //picks up replies reloaded from the response file
+        refreshResponses();
+
+        unsigned head = *this->cqHead;
+        unsigned tail = __atomic_load_n(this->cqTail, __ATOMIC_ACQUIRE);
+        while (head != tail)
+        {
+            struct io_uring_cqe *cqe = &this->cqes[head & *this->cqMask];
+            uint64_t userData = cqe->user_data;
+            int res = cqe->res;
+            uint32_t flags = cqe->flags;
+            head++;
+
+            uint64_t op = userData >> 61;
+            uint32_t generation = static_cast<uint32_t>((userData >> 32) & 0x1fffffffULL);
+            int fd = static_cast<int>(userData & 0xffffffffULL);
+
+            if (op == OP_ACCEPT)
+            {
+                handleAccept(res, flags);
+            }
+            else if (op == OP_RECV)
+            {
+                handleRecv(fd, generation, res, flags);
+            }
+            else if (op == OP_SEND)
+            {
+                handleSend(userData, fd, generation, res);
+            }
+            else if (op == OP_WAKE)
+            {
+                drainCompletions();
+                //the kernel ended the multishot poll, watch the queue again
+                if (!(flags & IORING_CQE_F_MORE) && !this->stopRequested.load(std::memory_order_relaxed))
+                {
+                    armWake();
+                }
+            }
+
+            //frees the completion slot as soon as it is read
+            __atomic_store_n(this->cqHead, head, __ATOMIC_RELEASE);
+            if (head == tail)
+            {
+                tail = __atomic_load_n(this->cqTail, __ATOMIC_ACQUIRE);
+            }
+        }
+
+        noteAccepts(this->acceptedThisPass);
+        this->acceptedThisPass = 0;
+        expireClients();
+        //accept stopped at the fd limit, re-armed once a client closed or the retry delay passed
+        if (acceptRetryDue() && !this->stopRequested.load(std::memory_order_relaxed))
+        {
+            this->acceptDeferred = false;
+            if (!this->acceptArmed)
+            {
+                armAccept();
+            }
+        }
+        publishStats();
+    }
+}
+
+//new client from the multishot accept
+void TCPUringServer::handleAccept(int res, uint32_t flags) {
+    if (res >= 0)
+    {
+        uring_conn &state = connState(res);
+        state.generation++;
+        state.sendInFlight = false;
+        state.recvArmed = false;
+
+        //multishot accept shares one address buffer between completions, so it is asked for here
+        if (openClient(res, nullptr) != nullptr)
+        {
+            armRecv(res);
+        }
+        this->acceptedThisPass++;
+    }
+    else if ((res == -EMFILE) || (res == -ENFILE))
+    {
+        //re-arming now would fail straight away, listenSvr does it once an fd may be free
+        deferAccept();
+    }
+
+    //kernel ended the multishot request, start a new one unless we are stopping or out of fds
+    if (!(flags & IORING_CQE_F_MORE))
+    {
+        this->acceptArmed = false;
+        if (!this->acceptDeferred && !this->stopRequested.load(std::memory_order_relaxed))
+        {
+            armAccept();
+        }
+    }
+}
+
+//data (or a hangup) from a client's multishot recv
+void TCPUringServer::handleRecv(int fd, uint32_t generation, int res, uint32_t flags) {
+    bool current = (fd >= 0) && (static_cast<size_t>(fd) < this->ringConns.size())
+                   && (this->ringConns[fd].generation == generation)
+                   && (this->clientObj_sockets.find(fd) != nullptr);
+
+    //kernel ended the multishot request, paused clients are re-armed by resumeReading
+    bool ended = !(flags & IORING_CQE_F_MORE);
+    if (current && ended)
+    {
+        this->ringConns[fd].recvArmed = false;
+    }
+
+    if (res > 0)
+    {
+        uint16_t bid = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+        if (current)
+        {
+            const char *data = this->bufPool + (static_cast<size_t>(bid) * RECV_BUF_SIZE);
+            TCPConn *client = this->clientObj_sockets.find(fd);
+            LOG_DEBUG("socket %d: %.*s", fd, res, data);
+            client->input.attach(this->readBlocks);
+            client->input.append(data, res);
+            this->metrics->add(MET_BYTES_IN, res);
+        }
+        recycleBuffer(bid);
+
+        if (!current)
+        {
+            return;
+        }
+        TCPConn *client = this->clientObj_sockets.find(fd);
+        if (!processCommands(*client))
+        {
+            //client sent exit
+            return;
+        }
+        //every complete command ran, the block goes back to the loop until more arrives
+        client->input.release(this->readBlocks);
+        if (ended && !client->readPaused)
+        {
+            armRecv(fd);
+        }
+        return;
+    }
+
+    if (!current)
+    {
+        return;
+    }
+    TCPConn *client = this->clientObj_sockets.find(fd);
+
+    //out of provided buffers (they come back as other completions are processed) or cancelled by pauseReading
+    if ((res == -ENOBUFS) || (res == -ECANCELED))
+    {
+        if (ended && !client->readPaused)
+        {
+            armRecv(fd);
+        }
+        return;
+    }
+
+    //a hangup is only acted on once the replies for everything before it have drained
+    if ((res == 0) && client->readPaused)
+    {
+        return;
+    }
+
+    //0 means an orderly hangup, anything else is a dead connection
+    printDisconnectedClientInfo(fd);
+    closeClient(fd);
+}
+
+//a batched sendmsg finished, whatever it did not take stays queued for the next one
+void TCPUringServer::handleSend(uint64_t userData, int fd, uint32_t generation, int res) {
+    std::unordered_map<uint64_t, uring_send>::iterator sent = this->inflightSends.find(userData);
+    if (sent == this->inflightSends.end())
+    {
+        return;
+    }
+    //drops the references that kept the replies alive for the kernel
+    this->inflightSends.erase(sent);
+
+    bool current = (static_cast<size_t>(fd) < this->ringConns.size()) && (this->ringConns[fd].generation == generation)
+                   && (this->clientObj_sockets.find(fd) != nullptr);
+    if (!current)
+    {
+        return;
+    }
+    this->ringConns[fd].sendInFlight = false;
+    TCPConn *client = this->clientObj_sockets.find(fd);
+    if (res < 0)
+    {
+        printDisconnectedClientInfo(fd);
+        closeClient(fd);
+        return;
+    }
+
+    client->output.consume(res);
+    this->metrics->add(MET_BYTES_OUT, res);
+    if (!client->output.empty())
+    {
+        queueFlush(*client);
+    }
+    if (canResume(*client))
+    {
+        resumeReading(*client);
+    }
+}
+
+/**********************************************************************************************
+ * pauseReading - Cancels the multishot recv of a client over the high-water mark so the kernel
+ *                stops handing it buffers. Data already in flight still lands in its input.
+ *
+ **********************************************************************************************/
+
+void TCPUringServer::pauseReading(TCPConn &client) {
+    TCPServer::pauseReading(client);
+    if ((this->ring_FD >= 0) && connState(client.socketObjFD).recvArmed)
+    {
+        cancelRecv(client.socketObjFD);
+    }
+}
+
+//runs the commands buffered while paused and re-arms the recv if the cancel already landed
+void TCPUringServer::resumeReading(TCPConn &client) {
+    if (this->ring_FD < 0)
+    {
+        TCPServer::resumeReading(client);
+        return;
+    }
+    int fd = client.socketObjFD;
+    unpauseReading(client);
+    if (!processCommands(client))
+    {
+        return;
+    }
+    if (!client.readPaused && !connState(fd).recvArmed)
+    {
+        armRecv(fd);
+    }
+}
+
+/**********************************************************************************************
+ * flushSends - Turns every client's queued replies into a single sendmsg. Only one send per
+ *              client is in flight at a time so replies can never be reordered.
+ *
+ **********************************************************************************************/
+
+void TCPUringServer::flushSends() {
+    for (int fd : this->dirtyClients)
+    {
+        TCPConn *client = this->clientObj_sockets.find(fd);
+        if ((client == nullptr) || !client->flushQueued)
+        {
+            continue;
+        }
+        client->flushQueued = false;
+        finishBatch(*client);
+        uring_conn &state = this->ringConns[fd];
+        if (state.sendInFlight || client->output.empty())
+        {
+            continue;
+        }
+
+        //the slices stay in the queue until the completion says how much was taken
+        uint64_t userData = packUserData(OP_SEND, state.generation, fd);
+        uring_send &pending = this->inflightSends[userData];
+        pending.iov.resize(OUTPUT_MAX_IOV);
+        pending.iov.resize(client->output.gather(pending.iov.data(), OUTPUT_MAX_IOV, &pending.hold));
+        memset(&pending.msg, 0, sizeof(pending.msg));
+        pending.msg.msg_iov = pending.iov.data();
+        pending.msg.msg_iovlen = pending.iov.size();
+        state.sendInFlight = true;
+
+        struct io_uring_sqe *sqe = getSQE();
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(&pending.msg);
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = userData;
+    }
+    this->dirtyClients.clear();
+}
+
+#else
+
+bool TCPUringServer::isSupported() {
+    return false;
+}
+
+bool TCPUringServer::setupRing() {
+    return false;
+}
+
+void TCPUringServer::teardownRing() {
+}
+
+void TCPUringServer::listenSvr() {
+    LOG_WARN("io_uring not available, falling back to epoll");
+    TCPServer::listenSvr();
+}
+
+void TCPUringServer::flushSends() {
+}
+
+void TCPUringServer::pauseReading(TCPConn &client) {
+    TCPServer::pauseReading(client);
+}
+
+void TCPUringServer::resumeReading(TCPConn &client) {
+    TCPServer::resumeReading(client);
+}
+
+#endif
+
+/**********************************************************************************************
+ * closeClient - Shuts the socket down first so its multishot recv and any send in flight
+ *               complete and drop their file references, then closes it like TCPServer does.
+ *
+ **********************************************************************************************/
+
+void TCPUringServer::closeClient(int inputClientFD) {
+    if ((this->ring_FD >= 0) && (inputClientFD > 0))
+    {
+        //replies still queued get one direct write, unless a send in flight would be overtaken
+        uring_conn &state = connState(inputClientFD);
+        TCPConn *client = this->clientObj_sockets.find(inputClientFD);
+        if (client != nullptr)
+        {
+            if (!state.sendInFlight)
+            {
+                ssize_t written = client->output.writeTo(inputClientFD);
+                if (written > 0)
+                {
+                    this->metrics->add(MET_BYTES_OUT, written);
+                }
+            }
+            client->output.clear();
+        }
+        state.generation++;
+        ::shutdown(inputClientFD, SHUT_RDWR);
+    }
+    TCPServer::closeClient(inputClientFD);
+}
+
+//sends submitted and not yet completed, the io_uring counterpart of clients waiting on EPOLLOUT
+size_t TCPUringServer::pendingWrites() const {
+    if (this->ring_FD < 0)
+    {
+        return TCPServer::pendingWrites();
+    }
+    return this->inflightSends.size();
+}
+
+//per fd state, grows with the highest fd seen
+uring_conn &TCPUringServer::connState(int fd) {
+    if (static_cast<size_t>(fd) >= this->ringConns.size())
+    {
+        this->ringConns.resize(fd + 1 + (fd >> 1));
+    }
+    return this->ringConns[fd];
+}
@@ -0,0 +1,196 @@
+#include "TimerWheel.h"
+
+TimerWheel::TimerWheel(unsigned int tickMs):tickMs((tickMs < 1) ? 1 : tickMs) {
+    for (int &head : this->heads)
+    {
+        head = -1;
+    }
+}
+
+TimerWheel::~TimerWheel() {
+}
+
+/**********************************************************************************************
+ * schedule - Sets fd's timer to fire at deadlineMs, rounded up to the next tick. A deadline
+ *            that has already passed fires on the next advance.
+ *
+ **********************************************************************************************/
+
+void TimerWheel::schedule(int fd, int64_t deadlineMs) {
+    if (fd < 0)
+    {
+        return;
+    }
+    if (static_cast<size_t>(fd) >= this->nodes.size())
+    {
+        this->nodes.resize(fd + 1 + (fd >> 1));
+    }
+    if (this->nodes[fd].slot >= 0)
+    {
+        unlink(fd);
+        this->count--;
+    }
+
+    //the current tick's slot has already been emptied, so the earliest a timer can fire is the next one
+    int64_t ticks = (deadlineMs + this->tickMs - 1) / this->tickMs;
+    uint64_t deadlineTick = (ticks > 0) ? static_cast<uint64_t>(ticks) : 0;
+    if (deadlineTick <= this->currentTick)
+    {
+        deadlineTick = this->currentTick + 1;
+    }
+    link(fd, deadlineTick);
+    this->count++;
+}
+
+void TimerWheel::cancel(int fd) {
+    if (scheduled(fd))
+    {
+        unlink(fd);
+        this->count--;
+    }
+}
+
+/**********************************************************************************************
+ * advance - Processes every tick up to nowMs. Level 0 slots are emptied into expired as they
+ *           are passed; each time level 0 wraps the next slot of the level above is spread
+ *           back down. When the wheel is empty it just jumps to the current tick.
+ *
+ **********************************************************************************************/
+
+void TimerWheel::advance(int64_t nowMs, std::vector<int> &expired) {
+    uint64_t target = (nowMs > 0) ? static_cast<uint64_t>(nowMs) / this->tickMs : 0;
+    if (this->count == 0)
+    {
+        if (target > this->currentTick)
+        {
+            this->currentTick = target;
+        }
+        return;
+    }
+
+    while ((this->currentTick < target) && (this->count > 0))
+    {
+        this->currentTick++;
+
+        //level 0 wrapped, bring the next block of each level down as far as it has wrapped too
+        for (int level = 1; level < TIMER_LEVELS; level++)
+        {
+            if ((this->currentTick & ((uint64_t(1) << (TIMER_SLOT_BITS * level)) - 1)) != 0)
+            {
+                break;
+            }
+            cascade(level);
+        }
+
+        int slot = static_cast<int>(this->currentTick & (TIMER_SLOTS - 1));
+        while (this->heads[slot] >= 0)
+        {
+            int fd = this->heads[slot];
+            unlink(fd);
+            this->count--;
+            expired.push_back(fd);
+        }
+    }
+    if (target > this->currentTick)
+    {
+        this->currentTick = target;
+    }
+}
+
+/**********************************************************************************************
+ * nextTimeoutMs - Time until the first occupied level 0 slot, or until level 0 next wraps if
+ *                 only higher levels hold timers (the cascade then refines it).
+ *
+ **********************************************************************************************/
+
+int TimerWheel::nextTimeoutMs(int64_t nowMs) const {
+    if (this->count == 0)
+    {
+        return -1;
+    }
+
+    //level 0 wraps in this many ticks, timers on higher levels can not come due before that
+    uint64_t ticks = TIMER_SLOTS - (this->currentTick & (TIMER_SLOTS - 1));
+    if (this->occupied[0] != 0)
+    {
+        //first occupied level 0 slot after currentTick, found by rotating the bitmap to start there
+        unsigned int shift = static_cast<unsigned int>((this->currentTick + 1) & (TIMER_SLOTS - 1));
+        uint64_t rotated = (this->occupied[0] >> shift) | ((shift == 0) ? 0 : (this->occupied[0] << (TIMER_SLOTS - shift)));
+        uint64_t firstDue = __builtin_ctzll(rotated) + 1;
+        if ((firstDue < ticks) || ((this->occupied[1] | this->occupied[2] | this->occupied[3]) == 0))
+        {
+            ticks = firstDue;
+        }
+    }
+
+    int64_t wakeMs = static_cast<int64_t>((this->currentTick + ticks) * this->tickMs) - nowMs;
+    if (wakeMs <= 0)
+    {
+        return 0;
+    }
+    return (wakeMs > 0x7fffffff) ? 0x7fffffff : static_cast<int>(wakeMs);
+}
+
+//puts fd in the slot its deadline falls in, relative to currentTick (a cascade may pass the current tick itself)
+void TimerWheel::link(int fd, uint64_t deadlineTick) {
+    uint64_t delta = deadlineTick - this->currentTick;
+
+    int level = 0;
+    while ((level < TIMER_LEVELS - 1) && (delta >= (uint64_t(1) << (TIMER_SLOT_BITS * (level + 1)))))
+    {
+        level++;
+    }
+    //beyond the top level the timer waits in the farthest slot and cascades again from there
+    uint64_t maxDelta = (uint64_t(1) << (TIMER_SLOT_BITS * TIMER_LEVELS)) - 1;
+    uint64_t placed = (delta > maxDelta) ? this->currentTick + maxDelta : deadlineTick;
+    int index = static_cast<int>((placed >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1));
+    int slot = level * TIMER_SLOTS + index;
+
+    timer_node &node = this->nodes[fd];
+    node.deadlineTick = deadlineTick;
+    node.slot = slot;
+    node.prev = -1;
+    node.next = this->heads[slot];
+    if (node.next >= 0)
+    {
+        this->nodes[node.next].prev = fd;
+    }
+    this->heads[slot] = fd;
+    this->occupied[level] |= uint64_t(1) << index;
+}
+
+void TimerWheel::unlink(int fd) {
+    timer_node &node = this->nodes[fd];
+    if (node.prev >= 0)
+    {
+        this->nodes[node.prev].next = node.next;
+    }
+    else
+    {
+        this->heads[node.slot] = node.next;
+        if (node.next < 0)
+        {
+            this->occupied[node.slot / TIMER_SLOTS] &= ~(uint64_t(1) << (node.slot % TIMER_SLOTS));
+        }
+    }
+    if (node.next >= 0)
+    {
+        this->nodes[node.next].prev = node.prev;
+    }
+    node.prev = -1;
+    node.next = -1;
+    node.slot = -1;
+}
+
+//re-links every timer in the level's current slot, which now lands one level lower (or fires)
+void TimerWheel::cascade(int level) {
+    int index = static_cast<int>((this->currentTick >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1));
+    int slot = level * TIMER_SLOTS + index;
+    while (this->heads[slot] >= 0)
+    {
+        int fd = this->heads[slot];
+        uint64_t deadlineTick = this->nodes[fd].deadlineTick;
+        unlink(fd);
+        link(fd, deadlineTick);
+    }
+}
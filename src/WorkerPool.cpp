@@ -0,0 +1,157 @@
+#include "WorkerPool.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+
+#include "exceptions.h"
+#include "Logger.h"
+
+CompletionQueue::CompletionQueue() {
+    this->event_FD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (this->event_FD < 0)
+    {
+        throw socket_error("eventfd failed");
+    }
+}
+
+//results nobody collected (the loop stopped first) are simply dropped
+CompletionQueue::~CompletionQueue() {
+    work_item *item = this->head.exchange(nullptr, std::memory_order_acquire);
+    while (item != nullptr)
+    {
+        work_item *next = item->next;
+        delete item;
+        item = next;
+    }
+    close(this->event_FD);
+}
+
+/**********************************************************************************************
+ * push - Called by a worker. Links the item in with a CAS loop and wakes the loop only if
+ *        the stack was empty, a non-empty stack already has a wakeup pending.
+ *
+ **********************************************************************************************/
+
+void CompletionQueue::push(work_item *item) {
+    work_item *old = this->head.load(std::memory_order_relaxed);
+    do
+    {
+        item->next = old;
+    } while (!this->head.compare_exchange_weak(old, item, std::memory_order_release, std::memory_order_relaxed));
+
+    if (old == nullptr)
+    {
+        uint64_t one = 1;
+        ssize_t written = write(this->event_FD, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+/**********************************************************************************************
+ * takeAll - Called by the owning loop. Clears the eventfd before taking the stack, so a push
+ *           that lands after the exchange always signals again. Returns the items in the
+ *           order they were completed, or nullptr.
+ *
+ **********************************************************************************************/
+
+work_item *CompletionQueue::takeAll() {
+    uint64_t count;
+    ssize_t got = read(this->event_FD, &count, sizeof(count));
+    (void)got;
+
+    work_item *item = this->head.exchange(nullptr, std::memory_order_acquire);
+
+    //the stack is newest first, reversed so replies go out in completion order
+    work_item *ordered = nullptr;
+    while (item != nullptr)
+    {
+        work_item *next = item->next;
+        item->next = ordered;
+        ordered = item;
+        item = next;
+    }
+    return ordered;
+}
+
+WorkerPool::WorkerPool() {
+}
+
+WorkerPool::~WorkerPool() {
+    stop();
+}
+
+WorkerPool &WorkerPool::instance() {
+    static WorkerPool pool;
+    return pool;
+}
+
+void WorkerPool::start(unsigned int threads, size_t maxQueued) {
+    this->maxQueued = (maxQueued < 1) ? 1 : maxQueued;
+    this->stopping = false;
+    for (unsigned int i = 0; i < threads; i++)
+    {
+        this->threads.emplace_back(&WorkerPool::run, this);
+    }
+}
+
+void WorkerPool::stop() {
+    {
+        std::lock_guard<std::mutex> guard(this->queueLock);
+        this->stopping = true;
+        for (work_item *item : this->queue)
+        {
+            delete item;
+        }
+        this->queue.clear();
+    }
+    this->queueReady.notify_all();
+    for (std::thread &thread : this->threads)
+    {
+        thread.join();
+    }
+    this->threads.clear();
+}
+
+bool WorkerPool::submit(work_item *item) {
+    {
+        std::lock_guard<std::mutex> guard(this->queueLock);
+        if (this->stopping || this->threads.empty() || (this->queue.size() >= this->maxQueued))
+        {
+            return false;
+        }
+        this->queue.push_back(item);
+    }
+    this->queueReady.notify_one();
+    return true;
+}
+
+//worker thread: runs items until stop, every item goes back to its loop
+void WorkerPool::run() {
+    while (true)
+    {
+        work_item *item;
+        {
+            std::unique_lock<std::mutex> guard(this->queueLock);
+            this->queueReady.wait(guard, [this]() { return this->stopping || !this->queue.empty(); });
+            if (this->queue.empty())
+            {
+                return;
+            }
+            item = this->queue.front();
+            this->queue.pop_front();
+        }
+
+        execute(*item);
+        item->owner->push(item);
+    }
+}
+
+void WorkerPool::execute(work_item &item) {
+    try {
+        item.result = item.work();
+    } catch (std::exception &e) {
+        LOG_ERROR("Offloaded command failed: %s", e.what());
+        item.result = "Command failed\n\n";
+    }
+}
@@ -0,0 +1,117 @@
+/****************************************************************************************
+ * my_adduser - adds users to (or changes passwords in) the server's password file
+ *
+ *              Safe to run while the server has the file open, the server picks the
+ *              change up the next time it needs the user.
+ *
+ ****************************************************************************************/
+
+#include <stdexcept>
+#include <iostream>
+#include <string>
+#include <getopt.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <termios.h>
+#include "PasswdMgr.h"
+
+using namespace std;
+
+// default file the server reads users from
+const char default_pwfile[] = "passwd";
+
+void displayHelp(const char *execname) {
+   std::cout << execname << " [-f <passwdfile>] [-u] <username>\n";
+   std::cout << execname << " [-f <passwdfile>] -c\n";
+   std::cout << "   f: password file (default " << default_pwfile << ")\n";
+   std::cout << "   u: change the password of an existing user instead of adding one\n";
+   std::cout << "   c: compact the file, dropping records replaced by later changes\n";
+}
+
+// reads one line from stdin, without echo when it is a terminal
+static bool readPassword(const char *prompt, std::string &passwd) {
+   struct termios saved;
+   bool terminal = isatty(STDIN_FILENO) && (tcgetattr(STDIN_FILENO, &saved) == 0);
+   if (terminal) {
+      struct termios quiet = saved;
+      quiet.c_lflag &= ~ECHO;
+      tcsetattr(STDIN_FILENO, TCSAFLUSH, &quiet);
+      std::cout << prompt << std::flush;
+   }
+   bool got = static_cast<bool>(std::getline(std::cin, passwd));
+   if (terminal) {
+      tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved);
+      std::cout << "\n";
+   }
+   return got;
+}
+
+int main(int argc, char *argv[]) {
+   std::string pwfile(default_pwfile);
+   bool update = false;
+   bool compactOnly = false;
+   int c = 0;
+   while ((c = getopt(argc, argv, "f:uch")) != -1) {
+      switch (c) {
+      case 'f':
+         pwfile = optarg;
+         break;
+      case 'u':
+         update = true;
+         break;
+      case 'c':
+         compactOnly = true;
+         break;
+      default:
+         displayHelp(argv[0]);
+         exit(0);
+      }
+   }
+   if (!compactOnly && (optind != argc - 1)) {
+      displayHelp(argv[0]);
+      exit(0);
+   }
+
+   try {
+      PasswdMgr store(pwfile.c_str());
+      if (compactOnly) {
+         size_t dropped = store.superseded();
+         store.compact();
+         std::cout << pwfile << ": " << store.users() << " users, " << dropped << " old records dropped\n";
+         return 0;
+      }
+
+      const char *name = argv[optind];
+      if (!PasswdMgr::validName(name, strlen(name))) {
+         std::cerr << "User names are 1 to " << PASSWD_MAX_NAME << " printable characters without spaces\n";
+         return 1;
+      }
+      if (update != store.checkUser(name)) {
+         std::cerr << (update ? "No such user: " : "User already exists: ") << name << "\n";
+         return 1;
+      }
+
+      std::string passwd;
+      std::string confirm;
+      if (!readPassword("Password: ", passwd) || !readPassword("Confirm password: ", confirm)) {
+         std::cerr << "No password given\n";
+         return 1;
+      }
+      if (passwd != confirm) {
+         std::cerr << "Passwords do not match\n";
+         return 1;
+      }
+
+      bool done = update ? store.changePasswd(name, passwd.c_str()) : store.addUser(name, passwd.c_str());
+      if (!done) {
+         std::cerr << "User " << name << " was changed by someone else, try again\n";
+         return 1;
+      }
+      std::cout << (update ? "Password changed for " : "Added user ") << name << "\n";
+   } catch (std::exception &e) {
+      std::cerr << "my_adduser: " << e.what() << "\n";
+      return 1;
+   }
+   return 0;
+}
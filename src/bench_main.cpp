@@ -0,0 +1,90 @@
+/****************************************************************************************
+ * tcpbench - load generator for tcpserver, reports throughput and latency percentiles
+ *
+ *              Runs closed loop by default; -r switches to a fixed request rate with
+ *              latency corrected for coordinated omission.
+ *
+ ****************************************************************************************/  
+
+#include <stdexcept>
+#include <iostream>
+#include <getopt.h>
+#include "exceptions.h"
+#include "TCPBench.h"
+
+using namespace std; 
+
+void displayHelp(const char *execname) {
+   std::cout << execname << " [-a <ip_addr>] [-p <portnum>] [-c <conns>] [-d <seconds>] [-r <rate>] [-P <depth>] [-t <threads>] [-m <mix>]\n";
+   std::cout << "   c: connections to open (default 100)\n";
+   std::cout << "   d: seconds to run (default 10)\n";
+   std::cout << "   r: total requests per second, 0 runs closed loop (default 0)\n";
+   std::cout << "   P: commands in flight per connection (default 1)\n";
+   std::cout << "   t: worker threads (default 1)\n";
+   std::cout << "   m: command mix as cmd:weight,... (default hello:1,1:1,2:1,3:1,4:1,5:1,menu:1,bogus:1)\n";
+   std::cout << "   The server must run without -B, replies are framed by their prompt\n";
+}
+
+int main(int argc, char *argv[]) {
+   TCPBench bench;
+   std::string ip_addr = "127.0.0.1";
+   long portval = 9999;
+   long value = 0;
+   int c = 0;
+
+   try {
+      while ((c = getopt(argc, argv, "a:p:c:d:r:P:t:m:h")) != -1) {
+         switch (c) {
+         case 'a':
+            ip_addr = optarg;
+            break;
+         case 'p':
+            portval = strtol(optarg, NULL, 10);
+            if ((portval < 1) || (portval > 65535)) {
+               std::cout << "Invalid port. Value must be between 1 and 65535\n";
+               exit(0);
+            }
+            break;
+         case 'c':
+            bench.setConnections(strtoul(optarg, NULL, 10));
+            break;
+         case 'd':
+            bench.setDuration(strtoul(optarg, NULL, 10));
+            break;
+         case 'r':
+            bench.setRate(strtoull(optarg, NULL, 10));
+            break;
+         case 'P':
+            value = strtol(optarg, NULL, 10);
+            if ((value < 1) || (value > 4096)) {
+               std::cout << "Invalid pipeline depth. Value must be between 1 and 4096\n";
+               exit(0);
+            }
+            bench.setPipeline(value);
+            break;
+         case 't':
+            bench.setThreads(strtoul(optarg, NULL, 10));
+            break;
+         case 'm':
+            bench.setMix(optarg);
+            break;
+         default:
+            displayHelp(argv[0]);
+            exit(0);
+         }
+      }
+   } catch (invalid_argument &e) {
+      cerr << e.what() << endl;
+      return -1;
+   }
+
+   bench.setTarget(ip_addr, (unsigned short) portval);
+   try {
+      bench.run();
+   } catch (socket_error &e) {
+      cerr << "Benchmark failed: " << e.what() << endl;
+      return -1;
+   }
+   bench.printReport();
+   return 0;
+}
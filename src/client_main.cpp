@@ -15,23 +15,56 @@
 using namespace std; 
 
 void displayHelp(const char *execname) {
-   std::cout << execname << " <ip_addr> <port>\n";
+   std::cout << execname << " [-f <cmdfile> [-n <repeat>] [-P <depth>]] <ip_addr> <port>\n";
+   std::cout << "   f: batch mode, sends the commands in cmdfile and prints each one's round-trip time\n";
+   std::cout << "   n: times to run through cmdfile (default 1)\n";
+   std::cout << "   P: commands kept in flight (default 1)\n";
 }
 
 
 int main(int argc, char *argv[]) {
 
+   // Get the command line arguments and set params appropriately
+   std::string batchFile;
+   long repeat = 1;
+   long depth = 1;
+   int c = 0;
+   while ((c = getopt(argc, argv, "f:n:P:h")) != -1) {
+      switch (c) {
+      case 'f':
+         batchFile = optarg;
+         break;
+      case 'n':
+         repeat = strtol(optarg, NULL, 10);
+         if (repeat < 1) {
+            std::cout << "Invalid repeat count. Value must be at least 1\n";
+            exit(0);
+         }
+         break;
+      case 'P':
+         depth = strtol(optarg, NULL, 10);
+         if ((depth < 1) || (depth > 65536)) {
+            std::cout << "Invalid pipeline depth. Value must be between 1 and 65536\n";
+            exit(0);
+         }
+         break;
+      default:
+         displayHelp(argv[0]);
+         exit(0);
+      }
+   }
+
    // Check the command line input
-   if (argc < 3) {
+   if (argc - optind < 2) {
       displayHelp(argv[0]);
       exit(0);
    }
 
    // Read in the IP address from the command line
-   std::string ip_addr(argv[1]);
+   std::string ip_addr(argv[optind]);
 
    // Read in the port
-   long portval = strtol(argv[2], NULL, 10);
+   long portval = strtol(argv[optind + 1], NULL, 10);
    if ((portval < 1) || (portval > 65535)) {
       std::cout << "Invalid port. Value must be between 1 and 65535";
       std::cout << "Format: " << argv[0] << " [<max_range>] [<max_threads>]\n";
@@ -39,11 +72,10 @@ int main(int argc, char *argv[]) {
    }
    unsigned short port = (unsigned short) portval;
  
-
-   // Get the command line arguments and set params appropriately
-
    // Try to set up the server for listening
    TCPClient client;
+   if (!batchFile.empty())
+      client.setBatch(batchFile, repeat, depth);
    try {
       cout << "Connecting to " << ip_addr << " port " << port << endl;
       client.connectTo(ip_addr.c_str(), port);
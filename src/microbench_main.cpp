@@ -0,0 +1,309 @@
+/****************************************************************************************
+ * microbench - micro-benchmarks for the server's per-command hot paths: newline framing,
+ *              command dispatch and the string helpers. Built and run by "make bench".
+ *
+ *              Every case runs over a fixed input until at least the minimum time has
+ *              passed and prints one JSON object per line, so results can be diffed or
+ *              fed to a regression checker.
+ *
+ ****************************************************************************************/
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "TCPServer.h"
+#include "LineBuffer.h"
+#include "strfuncts.h"
+
+using namespace std;
+
+// TCPServer with nothing bound, only here to reach the command dispatch path
+class bench_server : public TCPServer
+{
+public:
+   //replies are dropped rather than written, so a read never has to pause for them
+   bench_server() { refreshResponses(); setHighWater(SIZE_MAX); }
+};
+
+// a measured case: run() does one pass over its input and returns the operations and bytes it covered
+class bench_case
+{
+public:
+   std::string name;
+   std::function<void(uint64_t &ops, uint64_t &bytes)> run;
+};
+
+// keeps the compiler from dropping work whose result is otherwise unused
+template <class T>
+static inline void keep(const T &value) {
+   asm volatile("" : : "g"(&value) : "memory");
+}
+
+void displayHelp(const char *execname) {
+   std::cout << execname << " [-m <ms>] [-f <filter>]\n";
+   std::cout << "   m: minimum run time per case in milliseconds (default 300)\n";
+   std::cout << "   f: only run cases whose name contains filter\n";
+}
+
+// repeats lines (each given without its terminator) until the input is at least size bytes
+static std::string makeStream(const vector<std::string> &lines, const char *terminator, size_t size) {
+   std::string stream;
+   while (stream.size() < size) {
+      for (const std::string &line : lines) {
+         stream += line;
+         stream += terminator;
+      }
+   }
+   return stream;
+}
+
+// a line of printable junk with no spaces or newlines
+static std::string makeLongLine(size_t length) {
+   std::string line;
+   for (size_t i = 0; i < length; i++)
+      line += static_cast<char>('a' + (i * 7) % 26);
+   return line;
+}
+
+// feeds stream into a LineBuffer in reads of chunk bytes and frames it like processCommands
+static void frameStream(const std::string &stream, size_t chunk, uint64_t &ops, uint64_t &bytes) {
+   LineBuffer input;
+   std::string_view line;
+   size_t lengths = 0;
+   for (size_t pos = 0; pos < stream.size(); pos += chunk) {
+      size_t n = std::min(chunk, stream.size() - pos);
+      memcpy(input.writePtr(n), stream.data() + pos, n);
+      input.commit(n);
+      while (input.nextLine(line)) {
+         while (!line.empty() && (line.back() == '\r'))
+            line.remove_suffix(1);
+         lengths += line.size();
+         ops++;
+      }
+   }
+   keep(lengths);
+   bytes += stream.size();
+}
+
+static void addFramingCases(vector<bench_case> &cases) {
+   const vector<std::string> shortCommands = {"hello", "1", "2", "menu", "3", "passwd", "4", "5", "bogus"};
+   std::string pipelined = makeStream(shortCommands, "\n", 1 << 20);
+   std::string crlf = makeStream(shortCommands, "\r\n", 1 << 20);
+   std::string longLines = makeStream({makeLongLine(4000)}, "\n", 1 << 20);
+   std::string dribble = makeStream({makeLongLine(200)}, "\r\n", 64 << 10);
+
+   cases.push_back({"framing/pipelined_16k_reads", [pipelined](uint64_t &ops, uint64_t &bytes) { frameStream(pipelined, 16384, ops, bytes); }});
+   cases.push_back({"framing/crlf_16k_reads", [crlf](uint64_t &ops, uint64_t &bytes) { frameStream(crlf, 16384, ops, bytes); }});
+   cases.push_back({"framing/long_lines_4k_reads", [longLines](uint64_t &ops, uint64_t &bytes) { frameStream(longLines, 4096, ops, bytes); }});
+   cases.push_back({"framing/split_7_byte_reads", [pipelined](uint64_t &ops, uint64_t &bytes) { frameStream(pipelined, 7, ops, bytes); }});
+   cases.push_back({"framing/dribble_1_byte_reads", [dribble](uint64_t &ops, uint64_t &bytes) { frameStream(dribble, 1, ops, bytes); }});
+}
+
+static void addDispatchCases(vector<bench_case> &cases, bench_server &server, TCPConn &client) {
+   // replies pile up in the client's output queue, dropped after every pass
+   const vector<std::string> mix = {"hello", "1", "2", "3", "4", "5", "menu", "passwd"};
+   const vector<std::string> unknown = {"bogus", "hello there", "HELLO", "exi", "menuu", makeLongLine(1000)};
+
+   cases.push_back({"dispatch/known_mix", [&server, &client, mix](uint64_t &ops, uint64_t &bytes) {
+      for (int round = 0; round < 256; round++) {
+         for (const std::string &command : mix) {
+            server.dispatchCommand(client, command);
+            bytes += command.size();
+            ops++;
+         }
+      }
+      client.output.clear();
+   }});
+   cases.push_back({"dispatch/unknown", [&server, &client, unknown](uint64_t &ops, uint64_t &bytes) {
+      for (int round = 0; round < 256; round++) {
+         for (const std::string &command : unknown) {
+            server.dispatchCommand(client, command);
+            bytes += command.size();
+            ops++;
+         }
+      }
+      client.output.clear();
+   }});
+
+   // framing and dispatch together, the way a read of pipelined commands is handled
+   std::string pipelined = makeStream(mix, "\r\n", 16384);
+   uint64_t lineCount = std::count(pipelined.begin(), pipelined.end(), '\n');
+   cases.push_back({"dispatch/process_pipelined_read", [&server, &client, pipelined, lineCount](uint64_t &ops, uint64_t &bytes) {
+      client.input.append(pipelined.data(), pipelined.size());
+      server.processCommands(client);
+      client.output.clear();
+      ops += lineCount;
+      bytes += pipelined.size();
+   }});
+}
+
+static void addStringCases(vector<bench_case> &cases) {
+   const std::string command = "hello\r\n";
+   const std::string manyNewlines = makeStream({"ab", "c", ""}, "\r\n", 4096);
+   const std::string passwdLine = "PASSWD user secret\r\n";
+   const std::string noDelimiter = makeLongLine(4096);
+   std::string mixedCase = makeLongLine(4096);
+   for (size_t i = 0; i < mixedCase.size(); i += 2)
+      mixedCase[i] = static_cast<char>(toupper(mixedCase[i]));
+
+   cases.push_back({"strfuncts/clrNewlines_command", [command](uint64_t &ops, uint64_t &bytes) {
+      for (int i = 0; i < 1024; i++) {
+         std::string copy = command;
+         clrNewlines(copy);
+         keep(copy);
+      }
+      ops += 1024;
+      bytes += 1024 * command.size();
+   }});
+   cases.push_back({"strfuncts/clrNewlines_4k_crlf", [manyNewlines](uint64_t &ops, uint64_t &bytes) {
+      std::string copy = manyNewlines;
+      clrNewlines(copy);
+      keep(copy);
+      ops++;
+      bytes += manyNewlines.size();
+   }});
+   cases.push_back({"strfuncts/split_passwd", [passwdLine](uint64_t &ops, uint64_t &bytes) {
+      std::string orig = passwdLine;
+      std::string left;
+      std::string right;
+      for (int i = 0; i < 1024; i++) {
+         split(orig, left, right, ' ');
+         keep(right);
+      }
+      ops += 1024;
+      bytes += 1024 * passwdLine.size();
+   }});
+   cases.push_back({"strfuncts/split_4k_no_delimiter", [noDelimiter](uint64_t &ops, uint64_t &bytes) {
+      std::string orig = noDelimiter;
+      std::string left;
+      std::string right;
+      keep(split(orig, left, right, ' '));
+      ops++;
+      bytes += noDelimiter.size();
+   }});
+   cases.push_back({"strfuncts/lower_command", [](uint64_t &ops, uint64_t &bytes) {
+      for (int i = 0; i < 1024; i++) {
+         std::string copy = "PassWD";
+         lower(copy);
+         keep(copy);
+      }
+      ops += 1024;
+      bytes += 1024 * 6;
+   }});
+   cases.push_back({"strfuncts/lower_4k_mixed_case", [mixedCase](uint64_t &ops, uint64_t &bytes) {
+      std::string copy = mixedCase;
+      lower(copy);
+      keep(copy);
+      ops++;
+      bytes += mixedCase.size();
+   }});
+
+   // the string_view versions, nothing copied or allocated
+   cases.push_back({"strfuncts/trimNewlines_view_command", [command](uint64_t &ops, uint64_t &bytes) {
+      for (int i = 0; i < 1024; i++)
+         keep(trimNewlines(command));
+      ops += 1024;
+      bytes += 1024 * command.size();
+   }});
+   cases.push_back({"strfuncts/findNewline_4k_none", [noDelimiter](uint64_t &ops, uint64_t &bytes) {
+      keep(findNewline(noDelimiter));
+      ops++;
+      bytes += noDelimiter.size();
+   }});
+   cases.push_back({"strfuncts/split_view_passwd", [passwdLine](uint64_t &ops, uint64_t &bytes) {
+      std::string_view left;
+      std::string_view right;
+      for (int i = 0; i < 1024; i++) {
+         split(std::string_view(passwdLine), left, right, ' ');
+         keep(right);
+      }
+      ops += 1024;
+      bytes += 1024 * passwdLine.size();
+   }});
+   cases.push_back({"strfuncts/lower_4k_in_place", [mixedCase](uint64_t &ops, uint64_t &bytes) {
+      std::string buffer = mixedCase;
+      lower(&buffer[0], buffer.size());
+      keep(buffer);
+      ops++;
+      bytes += mixedCase.size();
+   }});
+}
+
+// repeats a case until minMs have passed (after one warm-up pass) and prints its line
+static void runCase(const bench_case &item, long minMs) {
+   uint64_t ops = 0;
+   uint64_t bytes = 0;
+   item.run(ops, bytes);
+
+   ops = 0;
+   bytes = 0;
+   uint64_t passes = 0;
+   std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+   std::chrono::steady_clock::time_point deadline = started + std::chrono::milliseconds(minMs);
+   std::chrono::steady_clock::time_point now;
+   do {
+      item.run(ops, bytes);
+      passes++;
+      now = std::chrono::steady_clock::now();
+   } while (now < deadline);
+
+   double elapsedNs = std::chrono::duration_cast<std::chrono::nanoseconds>(now - started).count();
+   printf("{\"bench\":\"%s\",\"passes\":%llu,\"ops\":%llu,\"ns_per_op\":%.2f,\"mb_per_s\":%.1f}\n",
+          item.name.c_str(), (unsigned long long)passes, (unsigned long long)ops,
+          (ops > 0) ? elapsedNs / ops : 0.0, (bytes / (1024.0 * 1024.0)) / (elapsedNs / 1e9));
+   fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+   long minMs = 300;
+   std::string filter;
+   int c = 0;
+   while ((c = getopt(argc, argv, "m:f:h")) != -1) {
+      switch (c) {
+      case 'm':
+         minMs = strtol(optarg, NULL, 10);
+         if (minMs < 1) {
+            std::cout << "Invalid run time. Value must be at least 1 ms\n";
+            exit(0);
+         }
+         break;
+      case 'f':
+         filter = optarg;
+         break;
+      default:
+         displayHelp(argv[0]);
+         exit(0);
+      }
+   }
+
+   bench_server server;
+   TCPConn client;
+   struct sockaddr_in peer;
+   memset(&peer, 0, sizeof(peer));
+   peer.sin_family = AF_INET;
+   peer.sin_addr.s_addr = inet_addr("127.0.0.1");
+   peer.sin_port = htons(40000);
+   client.setPeer(reinterpret_cast<struct sockaddr *>(&peer));
+
+   vector<bench_case> cases;
+   addFramingCases(cases);
+   addDispatchCases(cases, server, client);
+   addStringCases(cases);
+
+   for (const bench_case &item : cases) {
+      if (filter.empty() || (item.name.find(filter) != std::string::npos))
+         runCase(item, minMs);
+   }
+   return 0;
+}
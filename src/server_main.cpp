@@ -9,21 +9,77 @@
 #include <stdexcept>
 #include <iostream>
 #include <getopt.h>
+#include <thread>
+#include <memory>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
 #include "TCPServer.h"
+#include "ResponseStore.h"
+#include "TCPUringServer.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "AdmissionControl.h"
+#include "WorkerPool.h"
+#include "PasswdMgr.h"
+#include "SessionTickets.h"
+#include "exceptions.h"
 
 using namespace std; 
 
 void displayHelp(const char *execname) {
-   std::cout << execname << " [-p <portnum>] [-a <ip_addr>]\n";
+   std::cout << execname << " [-p <portnum>] [-a <ip_addr>] [-t <threads>] [-e <epoll|uring>] [-r <responsefile>] [-o <bytes>] [-B] [-b <backlog>] [-d <seconds>]\n";
+   std::cout << "      [-l <logfile>] [-v <debug|info|warn|error>] [-S <statsport>] [-i <seconds>] [-R <seconds>]\n";
+   std::cout << "      [-c <clients>] [-n <clients>] [-q <commands>] [-Q <commands>] [-W <threads>]\n";
+   std::cout << "      [-f <passwdfile>] [-T <seconds>]\n";
    std::cout << "   p: the port to bind the server to\n";
    std::cout << "   a: the IP address to bind the server\n";
+   std::cout << "   t: number of event loop threads (0 for one per core)\n";
+   std::cout << "   e: I/O engine, uring falls back to epoll if the kernel lacks support\n";
+   std::cout << "   r: file with the menu and other static replies, re-read on SIGHUP\n";
+   std::cout << "   o: unsent reply bytes at which a client stops being read (default 262144)\n";
+   std::cout << "   B: send the prompt once after a batch of pipelined replies, not after each one\n";
+   std::cout << "   b: length of the listen queue (default SOMAXCONN)\n";
+   std::cout << "   d: TCP_DEFER_ACCEPT timeout, only for clients that send before the greeting\n";
+   std::cout << "   l: file the server log is appended to (default stderr)\n";
+   std::cout << "   v: lowest log level written (default info, debug needs --enable-debug-log)\n";
+   std::cout << "   S: loopback-only port that answers every connection with the server stats\n";
+   std::cout << "   i: close clients that send nothing for this many seconds (default 0, never)\n";
+   std::cout << "   R: close clients that leave a command unfinished this long (default 0, never)\n";
+   std::cout << "   c: most clients connected at once, more are turned away busy (default 0, no limit)\n";
+   std::cout << "   n: most clients connected at once from one address (default 0, no limit)\n";
+   std::cout << "   q: commands per second allowed per client, reads are deferred beyond it (default 0, no limit)\n";
+   std::cout << "   Q: burst of commands a client may send at once (default the -q rate)\n";
+   std::cout << "   W: worker threads for expensive commands like passwd (default 2, 0 runs them in the event loop)\n";
+   std::cout << "   f: password file (see my_adduser), clients must log in as one of its users\n";
+   std::cout << "   T: give clients a session ticket at login, good for this many seconds, that \"resume <ticket>\"\n";
+   std::cout << "      takes instead of the password (default 0, no tickets; needs -f)\n";
 
 }
 
+// SIGHUP handler, the event loops do the actual reload
+void reloadResponses(int) {
+   ResponseStore::requestReload();
+}
+
+// SIGINT/SIGTERM stop the loops so main can shut down normally and remove the stats segment,
+// a second signal kills the server outright
+TCPServer *runningServer = nullptr;
+void stopServer(int) {
+   if (runningServer != nullptr)
+      runningServer->requestStop();
+}
+
 // global default values
 const unsigned short default_port = 9999;
 const char default_IP[] = "127.0.0.1";
 
+// commands waiting for a worker before new ones are answered busy
+const size_t worker_queue = 1024;
+
+// session tickets kept before the oldest is dropped
+const size_t ticket_capacity = 65536;
+
 int main(int argc, char *argv[]) {
 
 
@@ -33,7 +89,35 @@ int main(int argc, char *argv[]) {
    // Get the command line arguments and set params appropriately
    int c = 0;
    long portval;
-   while ((c = getopt(argc, argv, "p:a:smw")) != -1) {
+   long threadval;
+   unsigned int threads = 1;
+   std::string engine("epoll");
+   std::string responseFile;
+   long highwaterval;
+   size_t highWater = 262144;
+   bool batchPrompt = false;
+   long backlogval;
+   int backlog = SOMAXCONN;
+   long deferval;
+   int deferSecs = 0;
+   std::string logFile;
+   LogLevel logLevel = LOG_LEVEL_INFO;
+   long statsval;
+   unsigned short statsPort = 0;
+   long timeoutval;
+   unsigned int idleSecs = 0;
+   unsigned int readSecs = 0;
+   long limitval;
+   size_t maxClients = 0;
+   size_t maxPerAddress = 0;
+   unsigned int commandRate = 0;
+   unsigned int commandBurst = 0;
+   long workerval;
+   unsigned int workers = 2;
+   std::string passwdFile;
+   long ticketval;
+   unsigned int ticketSecs = 0;
+   while ((c = getopt(argc, argv, "p:a:t:e:r:o:Bb:d:l:v:S:i:R:c:n:q:Q:W:f:T:smw")) != -1) {
       switch (c) {
   
       // Set the max number to count up to	    
@@ -52,6 +136,152 @@ int main(int argc, char *argv[]) {
          ip_addr = optarg; 
          break;
 
+      // Number of event loops, each on its own thread and listening socket
+      case 't':
+         threadval = strtol(optarg, NULL, 10);
+         if ((threadval < 0) || (threadval > 1024)) {
+            std::cout << "Invalid thread count. Value must be between 0 and 1024\n";
+            exit(0);
+         }
+         threads = (threadval == 0) ? std::thread::hardware_concurrency() : (unsigned int) threadval;
+         break;
+
+      // Which Server engine to run
+      case 'e':
+         engine = optarg;
+         if ((engine != "epoll") && (engine != "uring")) {
+            std::cout << "Invalid engine. Value must be epoll or uring\n";
+            exit(0);
+         }
+         break;
+
+      // Static replies loaded from a file instead of the built in ones
+      case 'r':
+         responseFile = optarg;
+         break;
+
+      // Output high-water mark, bounds memory held for clients that read slowly
+      case 'o':
+         highwaterval = strtol(optarg, NULL, 10);
+         if (highwaterval < 1) {
+            std::cout << "Invalid output limit. Value must be at least 1 byte\n";
+            exit(0);
+         }
+         highWater = (size_t) highwaterval;
+         break;
+
+      // One prompt per batch of pipelined replies
+      case 'B':
+         batchPrompt = true;
+         break;
+
+      // Listen queue length
+      case 'b':
+         backlogval = strtol(optarg, NULL, 10);
+         if ((backlogval < 1) || (backlogval > 65535)) {
+            std::cout << "Invalid backlog. Value must be between 1 and 65535\n";
+            exit(0);
+         }
+         backlog = (int) backlogval;
+         break;
+
+      // Seconds the kernel may hold a connection waiting for its first data
+      case 'd':
+         deferval = strtol(optarg, NULL, 10);
+         if ((deferval < 0) || (deferval > 3600)) {
+            std::cout << "Invalid defer timeout. Value must be between 0 and 3600\n";
+            exit(0);
+         }
+         deferSecs = (int) deferval;
+         break;
+
+      // Where the log goes
+      case 'l':
+         logFile = optarg;
+         break;
+
+      // Least important log level that is still written
+      case 'v':
+         logLevel = Logger::parseLevel(optarg, LOG_LEVEL_INFO);
+         break;
+
+      // Admin stats listener, bound to loopback only
+      case 'S':
+         statsval = strtol(optarg, NULL, 10);
+         if ((statsval < 1) || (statsval > 65535)) {
+            std::cout << "Invalid stats port. Value must be between 1 and 65535\n";
+            exit(0);
+         }
+         statsPort = (unsigned short) statsval;
+         break;
+
+      // Idle and unfinished command timeouts
+      case 'i':
+      case 'R':
+         timeoutval = strtol(optarg, NULL, 10);
+         if ((timeoutval < 0) || (timeoutval > 86400)) {
+            std::cout << "Invalid timeout. Value must be between 0 and 86400 seconds\n";
+            exit(0);
+         }
+         if (c == 'i')
+            idleSecs = (unsigned int) timeoutval;
+         else
+            readSecs = (unsigned int) timeoutval;
+         break;
+
+      // Admission limits, checked when a client connects
+      case 'c':
+      case 'n':
+         limitval = strtol(optarg, NULL, 10);
+         if ((limitval < 0) || (limitval > 10000000)) {
+            std::cout << "Invalid client limit. Value must be between 0 and 10000000\n";
+            exit(0);
+         }
+         if (c == 'c')
+            maxClients = (size_t) limitval;
+         else
+            maxPerAddress = (size_t) limitval;
+         break;
+
+      // Per client command rate and burst
+      case 'q':
+      case 'Q':
+         limitval = strtol(optarg, NULL, 10);
+         if ((limitval < 0) || (limitval > 10000000)) {
+            std::cout << "Invalid command rate. Value must be between 0 and 10000000\n";
+            exit(0);
+         }
+         if (c == 'q')
+            commandRate = (unsigned int) limitval;
+         else
+            commandBurst = (unsigned int) limitval;
+         break;
+
+      // Worker pool size, shared by every event loop
+      case 'W':
+         workerval = strtol(optarg, NULL, 10);
+         if ((workerval < 0) || (workerval > 1024)) {
+            std::cout << "Invalid worker count. Value must be between 0 and 1024\n";
+            exit(0);
+         }
+         workers = (unsigned int) workerval;
+         break;
+
+      // Users to log in as
+      case 'f':
+         passwdFile = optarg;
+         break;
+
+      // Session ticket lifetime, tickets are off unless given
+      case 'T':
+         ticketval = strtol(optarg, NULL, 10);
+         if ((ticketval < 0) || (ticketval > 86400)) {
+            std::cout << "Invalid ticket lifetime. Value must be between 0 and 86400 seconds\n";
+            exit(0);
+         }
+         ticketSecs = (unsigned int) ticketval;
+         break;
+
       case '?':
 	      displayHelp(argv[0]);
 	      break;
@@ -64,11 +294,72 @@ int main(int argc, char *argv[]) {
 
    }
 
+   // Tickets stand in for a password, there is nothing to issue them for without a password file
+   if ((ticketSecs > 0) && passwdFile.empty()) {
+      std::cout << "Invalid option. Session tickets (-T) need a password file (-f)\n";
+      displayHelp(argv[0]);
+      exit(0);
+   }
+
+   // Log records are written by a background thread from here on
+   try {
+      Logger::instance().setLevel(logLevel);
+      Logger::instance().start(logFile);
+   } catch (runtime_error &e) {
+      cerr << "Server initialization failed: " << e.what() << endl;
+      return -1;
+   }
+
    // Try to set up the server for listening
-   TCPServer server;
+   // Load the static replies and re-read them whenever SIGHUP arrives
+   if (!responseFile.empty()) {
+      try {
+         ResponseStore::instance().loadFile(responseFile);
+      } catch (runtime_error &e) {
+         cerr << "Server initialization failed: " << e.what() << endl;
+         return -1;
+      }
+      struct sigaction reloadAction;
+      memset(&reloadAction, 0, sizeof(reloadAction));
+      reloadAction.sa_handler = reloadResponses;
+      sigemptyset(&reloadAction.sa_mask);
+      sigaction(SIGHUP, &reloadAction, NULL);
+   }
+
+   // Live counters for tcpserver-stat, must exist before the event loops are created
+   std::string segmentName = "/tcpserver-" + std::to_string(port);
+   try {
+      Metrics::instance().openSegment(segmentName);
+   } catch (runtime_error &e) {
+      LOG_WARN("Stats segment disabled: %s", e.what());
+   }
+
+   std::unique_ptr<TCPServer> server;
+   if (engine == "uring")
+      server = std::make_unique<TCPUringServer>();
+   else
+      server = std::make_unique<TCPServer>();
+   server->setThreads(threads);
+   server->setHighWater(highWater);
+   server->setBatchPrompt(batchPrompt);
+   server->setBacklog(backlog);
+   server->setDeferAccept(deferSecs);
+   server->setIdleTimeout(idleSecs);
+   server->setReadTimeout(readSecs);
+   server->setCommandRate(commandRate, commandBurst);
+   if (!passwdFile.empty()) {
+      try {
+         server->setPasswords(std::make_shared<PasswdMgr>(passwdFile.c_str()));
+         SessionTickets::instance().enable(ticketSecs, ticket_capacity);
+      } catch (runtime_error &e) {
+         cerr << "Server initialization failed: " << e.what() << endl;
+         return -1;
+      }
+   }
+   AdmissionControl::instance().setLimits(maxClients, maxPerAddress);
    try {
       cout << "Binding server to " << ip_addr << " port " << port << endl;
-      server.bindSvr(ip_addr.c_str(), port);
+      server->bindSvr(ip_addr.c_str(), port);
 
    } catch (invalid_argument &e) 
    {
@@ -78,15 +369,40 @@ int main(int argc, char *argv[]) {
 
    cout << "Server established.\n";
 
+   if (statsPort != 0) {
+      try {
+         Metrics::instance().startAdmin("127.0.0.1", statsPort);
+      } catch (socket_error &e) {
+         cerr << "Server initialization failed: " << e.what() << endl;
+         return -1;
+      }
+   }
+
+   WorkerPool::instance().start(workers, worker_queue);
+
+   runningServer = server.get();
+   struct sigaction stopAction;
+   memset(&stopAction, 0, sizeof(stopAction));
+   stopAction.sa_handler = stopServer;
+   stopAction.sa_flags = SA_RESETHAND;
+   sigemptyset(&stopAction.sa_mask);
+   sigaction(SIGINT, &stopAction, NULL);
+   sigaction(SIGTERM, &stopAction, NULL);
+
    try {
       cout << "Listening.\n";	   
-      server.listenSvr();
+      server->listenSvr();
    } catch (invalid_argument &e) {
       cerr << "Server error received: " << e.what() << endl;
       return -1;      
    }
 
-   server.shutdown();
+   // workers hand results to the event loops' queues, so they stop before the loops are torn down
+   WorkerPool::instance().stop();
+   server->shutdown();
+   Metrics::instance().stopAdmin();
+   Metrics::instance().closeSegment();
+   Logger::instance().stop();
 
    cout << "Server shut down\n";
    return 0;
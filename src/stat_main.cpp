@@ -0,0 +1,169 @@
+/****************************************************************************************
+ * tcpserver-stat - prints a running tcpserver's counters as per-interval rates, vmstat
+ *                  style, from the shared memory segment the server publishes
+ *
+ *              Reads the segment only, so watching the server costs it nothing.
+ *
+ ****************************************************************************************/  
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <getopt.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "StatsSegment.h"
+
+using namespace std; 
+
+void displayHelp(const char *execname) {
+   std::cout << execname << " [-p <portnum>] [-n <segment>] [-i <seconds>] [-c <count>]\n";
+   std::cout << "   p: port of the server to watch, selects segment /tcpserver-<port>\n";
+   std::cout << "   n: segment name, overrides -p\n";
+   std::cout << "   i: seconds between lines (default 1)\n";
+   std::cout << "   c: number of lines to print, 0 runs until interrupted (default 0)\n";
+}
+
+// sum of every event loop's block, false if one of them could not be read consistently
+static bool readTotals(const stats_segment *segment, stats_loop_values &totals) {
+   totals = stats_loop_values();
+   uint32_t loops = segment->loopCount.load(std::memory_order_acquire);
+   for (uint32_t i = 0; (i < loops) && (i < STATS_MAX_LOOPS); i++) {
+      stats_loop_values one;
+      if (!readLoopBlock(segment->loops[i], one))
+         return false;
+      for (int c = 0; c < MET_COUNTER_COUNT; c++)
+         totals.counters[c] += one.counters[c];
+      for (int j = 0; j < METRIC_MAX_COMMANDS; j++)
+         totals.commands[j] += one.commands[j];
+      totals.connections += one.connections;
+      totals.pausedClients += one.pausedClients;
+      totals.pendingWrites += one.pendingWrites;
+   }
+   return true;
+}
+
+static void printHeader(const stats_segment *segment, const vector<int> &columns) {
+   printf("%7s %6s %6s %9s %9s %9s %9s", "conns", "paused", "wpend", "accept/s", "cmds/s", "inKB/s", "outKB/s");
+   for (int id : columns) {
+      string label = string(segment->commandNames[id]) + "/s";
+      printf(" %8s", label.c_str());
+   }
+   printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+   std::string name = "/tcpserver-9999";
+   long interval = 1;
+   long count = 0;
+   int c = 0;
+   while ((c = getopt(argc, argv, "p:n:i:c:h")) != -1) {
+      switch (c) {
+      case 'p':
+         name = std::string("/tcpserver-") + optarg;
+         break;
+      case 'n':
+         name = optarg;
+         break;
+      case 'i':
+         interval = strtol(optarg, NULL, 10);
+         if (interval < 1) {
+            std::cout << "Invalid interval. Value must be at least 1 second\n";
+            exit(0);
+         }
+         break;
+      case 'c':
+         count = strtol(optarg, NULL, 10);
+         break;
+      default:
+         displayHelp(argv[0]);
+         exit(0);
+      }
+   }
+
+   // Attach read-only, the server never knows it is being watched
+   int fd = shm_open(name.c_str(), O_RDONLY, 0);
+   if (fd < 0) {
+      cerr << "Unable to open stats segment " << name << ": " << strerror(errno) << endl;
+      return -1;
+   }
+   struct stat info;
+   if ((fstat(fd, &info) < 0) || (static_cast<size_t>(info.st_size) < sizeof(stats_segment))) {
+      cerr << "Stats segment " << name << " is too small, server version mismatch?" << endl;
+      return -1;
+   }
+   void *mapped = mmap(NULL, sizeof(stats_segment), PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (mapped == MAP_FAILED) {
+      cerr << "Unable to map stats segment " << name << endl;
+      return -1;
+   }
+   const stats_segment *segment = static_cast<const stats_segment *>(mapped);
+   if ((__atomic_load_n(&segment->magic, __ATOMIC_ACQUIRE) != STATS_SEGMENT_MAGIC) || (segment->version != STATS_SEGMENT_VERSION)) {
+      cerr << "Stats segment " << name << " has an unknown layout" << endl;
+      return -1;
+   }
+
+   // One column per registered command, plus unknown
+   vector<int> columns;
+   for (int id = 0; id < METRIC_MAX_COMMANDS; id++) {
+      if (segment->commandNames[id][0] != '\0')
+         columns.push_back(id);
+   }
+   // A server killed without shutting down leaves its segment behind
+   if (!writerAlive(*segment)) {
+      cerr << "Stats segment " << name << " was left by tcpserver pid " << segment->serverPID << ", which is not running" << endl;
+      return -1;
+   }
+   cout << "tcpserver pid " << segment->serverPID << ", " << segment->loopCount.load() << " event loops\n";
+
+   // First line is the average since the server started, like vmstat
+   struct timespec now;
+   clock_gettime(CLOCK_REALTIME, &now);
+   double elapsed = ((now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0) - segment->startedMs) / 1000.0;
+   stats_loop_values previous;
+   stats_loop_values current;
+
+   for (long line = 0; (count == 0) || (line < count); line++) {
+      if (line % 20 == 0)
+         printHeader(segment, columns);
+      if (!writerAlive(*segment)) {
+         cerr << "tcpserver pid " << segment->serverPID << " has exited" << endl;
+         return -1;
+      }
+      if (!readTotals(segment, current)) {
+         // the server is alive but stuck mid-update (stopped?), the interval is tried again next line
+         printf("%7s  server not publishing, skipped\n", "-");
+         fflush(stdout);
+         sleep(interval);
+         elapsed += interval;
+         continue;
+      }
+      if (elapsed <= 0)
+         elapsed = 1;
+
+      printf("%7llu %6llu %6llu %9.0f %9.0f %9.1f %9.1f", (unsigned long long)current.connections,
+             (unsigned long long)current.pausedClients, (unsigned long long)current.pendingWrites,
+             (current.counters[MET_ACCEPTED] - previous.counters[MET_ACCEPTED]) / elapsed,
+             (current.counters[MET_COMMANDS] - previous.counters[MET_COMMANDS]) / elapsed,
+             (current.counters[MET_BYTES_IN] - previous.counters[MET_BYTES_IN]) / 1024.0 / elapsed,
+             (current.counters[MET_BYTES_OUT] - previous.counters[MET_BYTES_OUT]) / 1024.0 / elapsed);
+      for (int id : columns)
+         printf(" %8.0f", (current.commands[id] - previous.commands[id]) / elapsed);
+      printf("\n");
+      fflush(stdout);
+
+      if ((count != 0) && (line + 1 >= count))
+         break;
+      previous = current;
+      sleep(interval);
+      elapsed = interval;
+   }
+   return 0;
+}
@@ -1,29 +1,143 @@
 #include <algorithm>
+#include <string.h>
 #include <termios.h>
 #include "strfuncts.h"
 
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+/**********************************************************************************************
+ * Scan kernels - the byte loops behind clrNewlines, findNewline and lower. The scalar ones
+ *                finish the tails the vector ones leave; SSE2 is always there on x86-64, the
+ *                AVX2 ones are only used when the CPU reports it. Single byte searches go to
+ *                memchr, which the C library already vectorizes the same way.
+ *
+ **********************************************************************************************/
+
+struct string_kernels
+{
+   size_t (*findNewline)(const char *data, size_t len);
+   void (*lower)(char *data, size_t len);
+};
+
+static size_t newlineScalar(const char *data, size_t len) {
+   for (size_t i = 0; i < len; i++) {
+      if ((data[i] == '\r') || (data[i] == '\n'))
+         return i;
+   }
+   return len;
+}
+
+static void lowerScalar(char *data, size_t len) {
+   for (size_t i = 0; i < len; i++) {
+      if ((data[i] >= 'A') && (data[i] <= 'Z'))
+         data[i] = static_cast<char>(data[i] + ('a' - 'A'));
+   }
+}
+
+#ifdef __SSE2__
+static size_t newlineSSE2(const char *data, size_t len) {
+   const __m128i cr = _mm_set1_epi8('\r');
+   const __m128i lf = _mm_set1_epi8('\n');
+   size_t i = 0;
+   for (; i + 16 <= len; i += 16) {
+      __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+      int found = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, cr), _mm_cmpeq_epi8(chunk, lf)));
+      if (found != 0)
+         return i + __builtin_ctz(found);
+   }
+   return i + newlineScalar(data + i, len - i);
+}
+
+// bytes above 'Z' or at 0x80 and up compare below 'A' as signed, so only A-Z get the case bit
+static void lowerSSE2(char *data, size_t len) {
+   const __m128i beforeA = _mm_set1_epi8('A' - 1);
+   const __m128i afterZ = _mm_set1_epi8('Z' + 1);
+   const __m128i caseBit = _mm_set1_epi8('a' - 'A');
+   size_t i = 0;
+   for (; i + 16 <= len; i += 16) {
+      __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+      __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(chunk, beforeA), _mm_cmplt_epi8(chunk, afterZ));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(data + i), _mm_or_si128(chunk, _mm_and_si128(upper, caseBit)));
+   }
+   lowerScalar(data + i, len - i);
+}
+
+// the SSE2 kernels are not VEX encoded, calling one with the upper halves of the ymm registers
+// dirty costs a state transition far slower than the scan itself, hence the zeroupper before
+// every tail and short inputs never touching ymm at all
+__attribute__((target("avx2")))
+static size_t newlineAVX2(const char *data, size_t len) {
+   if (len < 32)
+      return newlineSSE2(data, len);
+   const __m256i cr = _mm256_set1_epi8('\r');
+   const __m256i lf = _mm256_set1_epi8('\n');
+   size_t i = 0;
+   for (; i + 32 <= len; i += 32) {
+      __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+      unsigned int found = static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, cr), _mm256_cmpeq_epi8(chunk, lf))));
+      if (found != 0)
+         return i + __builtin_ctz(found);
+   }
+   _mm256_zeroupper();
+   return i + newlineSSE2(data + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static void lowerAVX2(char *data, size_t len) {
+   if (len < 32)
+      return lowerSSE2(data, len);
+   const __m256i beforeA = _mm256_set1_epi8('A' - 1);
+   const __m256i afterZ = _mm256_set1_epi8('Z' + 1);
+   const __m256i caseBit = _mm256_set1_epi8('a' - 'A');
+   size_t i = 0;
+   for (; i + 32 <= len; i += 32) {
+      __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+      __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(chunk, beforeA), _mm256_cmpgt_epi8(afterZ, chunk));
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(data + i), _mm256_or_si256(chunk, _mm256_and_si256(upper, caseBit)));
+   }
+   _mm256_zeroupper();
+   lowerSSE2(data + i, len - i);
+}
+#endif
+
+static string_kernels pickKernels() {
+#ifdef __SSE2__
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2"))
+      return string_kernels{newlineAVX2, lowerAVX2};
+   return string_kernels{newlineSSE2, lowerSSE2};
+#else
+   return string_kernels{newlineScalar, lowerScalar};
+#endif
+}
+
+static const string_kernels &kernels() {
+   static const string_kernels chosen = pickKernels();
+   return chosen;
+}
+
 void clrNewlines(std::string &str) {
-   str.erase(std::remove(str.begin(), str.end(), '\r'), str.end());
-   str.erase(std::remove(str.begin(), str.end(), '\n'), str.end());
+   str.resize(clrNewlines(&str[0], str.size()));
 }
 
 bool split(std::string &orig, std::string &left, std::string &right, const char delimiter) {
-   int del_loc = orig.find(delimiter);
-   if (del_loc == std::string::npos)
+   std::string_view leftView;
+   std::string_view rightView;
+   if (!split(std::string_view(orig), leftView, rightView, delimiter))
       return false;
 
-   left = orig.substr(0, del_loc);
-   right = orig.substr(del_loc + 1, orig.size());
-   right.erase(std::remove(right.begin(), right.end(), '\n'), right.end());
-   right.erase(std::remove(right.begin(), right.end(), '\r'), right.end());
+   right.assign(rightView.data(), rightView.size());
+   left.assign(leftView.data(), leftView.size());
+   clrNewlines(right);
    lower(left);
 
    return true;
 }
 
 void lower(std::string &str) {
-   std::transform(str.begin(), str.end(), str.begin(),
-         [](unsigned char c){ return std::tolower(c); });
+   lower(&str[0], str.size());
 }
 
 int hideInput(int fd, bool hide) {
@@ -42,3 +156,45 @@ int hideInput(int fd, bool hide) {
    return 0;
 }
 
+// the vector scan finds the first line break, usually the one ending the line; anything after it
+// is compacted a byte at a time without branching on what each byte is
+size_t clrNewlines(char *data, size_t len) {
+   size_t write = kernels().findNewline(data, len);
+   for (size_t read = write; read < len; read++) {
+      char c = data[read];
+      data[write] = c;
+      write += static_cast<size_t>((c != '\r') & (c != '\n'));
+   }
+   return write;
+}
+
+std::string_view trimNewlines(std::string_view str) {
+   size_t len = str.size();
+   while ((len > 0) && ((str[len - 1] == '\r') || (str[len - 1] == '\n')))
+      len--;
+   return str.substr(0, len);
+}
+
+size_t findNewline(std::string_view str) {
+   size_t found = kernels().findNewline(str.data(), str.size());
+   return (found < str.size()) ? found : std::string_view::npos;
+}
+
+size_t findDelimiter(std::string_view str, const char delimiter) {
+   const void *found = memchr(str.data(), delimiter, str.size());
+   return (found != nullptr) ? static_cast<size_t>(static_cast<const char *>(found) - str.data()) : std::string_view::npos;
+}
+
+bool split(std::string_view orig, std::string_view &left, std::string_view &right, const char delimiter) {
+   size_t del_loc = findDelimiter(orig, delimiter);
+   if (del_loc == std::string_view::npos)
+      return false;
+
+   left = orig.substr(0, del_loc);
+   right = trimNewlines(orig.substr(del_loc + 1));
+   return true;
+}
+
+void lower(char *data, size_t len) {
+   kernels().lower(data, len);
+}